@@ -0,0 +1,300 @@
+#include "Autoindex.hpp"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+static std::string htmlEscape(const std::string& str) {
+    std::string out;
+    for (size_t i = 0; i < str.size(); ++i) {
+        switch (str[i]) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += str[i];
+        }
+    }
+    return out;
+}
+
+static std::string urlEncode(const std::string& str) {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    for (size_t i = 0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+            || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+    return out;
+}
+
+static const char* const k_sort_names[Autoindex::SORT_KEY_COUNT] = { "name", "size", "mtime" };
+
+// Orders entry indices by one key, ties broken by name.
+struct EntryOrder {
+    const std::vector<Autoindex::Entry>* entries;
+    Autoindex::SortKey key;
+
+    bool operator()(size_t a, size_t b) const {
+        const Autoindex::Entry& x = (*entries)[a];
+        const Autoindex::Entry& y = (*entries)[b];
+        if (key == Autoindex::SORT_SIZE && x.size != y.size) return x.size < y.size;
+        if (key == Autoindex::SORT_MTIME && x.mtime != y.mtime) return x.mtime < y.mtime;
+        return x.name < y.name;
+    }
+};
+
+Autoindex::Query Autoindex::Query::parse(const std::string& query_string, size_t page_size) {
+    Query query;
+    query.page_size = page_size;
+    std::stringstream ss(query_string);
+    std::string param;
+    while (std::getline(ss, param, '&')) {
+        size_t eq = param.find('=');
+        if (eq == std::string::npos) continue;
+        std::string name = param.substr(0, eq);
+        std::string value = param.substr(eq + 1);
+        if (name == "sort") {
+            for (int k = 0; k < SORT_KEY_COUNT; ++k) {
+                if (value == k_sort_names[k]) query.sort = static_cast<SortKey>(k);
+            }
+        } else if (name == "order") {
+            query.descending = (value == "desc");
+        } else if (name == "page" && page_size > 0) {
+            long page = std::strtol(value.c_str(), NULL, 10);
+            if (page > 0) query.page = static_cast<size_t>(page);
+        }
+    }
+    return query;
+}
+
+std::string Autoindex::Query::key() const {
+    std::stringstream ss;
+    ss << sort << (descending ? "d" : "a") << page << "/" << page_size;
+    return ss.str();
+}
+
+Autoindex::Autoindex(size_t max_dirs) : _max_dirs(max_dirs), _hits(0), _misses(0) {}
+
+Autoindex::~Autoindex() {
+    for (SnapshotList::iterator it = _lru.begin(); it != _lru.end(); ++it) _release(*it);
+}
+
+void Autoindex::_release(Snapshot* snapshot) {
+    if (--snapshot->refs == 0) delete snapshot;
+}
+
+Autoindex::Snapshot* Autoindex::_find(const std::string& dir, time_t mtime) {
+    for (SnapshotList::iterator it = _lru.begin(); it != _lru.end(); ++it) {
+        if ((*it)->path != dir) continue;
+        Snapshot* snapshot = *it;
+        _lru.erase(it);
+        if (snapshot->mtime != mtime) { // The directory changed since
+            _release(snapshot);
+            return NULL;
+        }
+        _lru.push_front(snapshot);
+        return snapshot;
+    }
+    return NULL;
+}
+
+void Autoindex::_store(Snapshot* snapshot) {
+    if (_max_dirs == 0) return;
+    for (SnapshotList::iterator it = _lru.begin(); it != _lru.end(); ++it) {
+        if ((*it)->path == snapshot->path) {
+            _release(*it);
+            _lru.erase(it);
+            break;
+        }
+    }
+    ++snapshot->refs;
+    _lru.push_front(snapshot);
+    while (_lru.size() > _max_dirs) {
+        _release(_lru.back());
+        _lru.pop_back();
+    }
+}
+
+const std::string* Autoindex::findPage(const std::string& dir, time_t mtime, const Query& query) {
+    Snapshot* snapshot = _find(dir, mtime);
+    if (!snapshot) return NULL;
+    std::map<std::string, std::string>::const_iterator it = snapshot->pages.find(query.key());
+    if (it == snapshot->pages.end()) return NULL;
+    ++_hits;
+    return &it->second;
+}
+
+Autoindex::Job* Autoindex::start(const std::string& dir, time_t mtime, const std::string& uri, const Query& query) {
+    return new Job(*this, dir, mtime, uri, query);
+}
+
+unsigned long Autoindex::getHits() const { return _hits; }
+unsigned long Autoindex::getMisses() const { return _misses; }
+
+Autoindex::Job::Job(Autoindex& owner, const std::string& dir, time_t mtime, const std::string& uri, const Query& query) :
+    _owner(owner),
+    _uri(uri),
+    _query(query),
+    _snapshot(owner._find(dir, mtime)),
+    _dir(NULL),
+    _scanStart(time(NULL)),
+    _state(STATE_SCAN),
+    _failed(false),
+    _cursor(0),
+    _end(0)
+{
+    ++_owner._misses;
+    if (_snapshot) {
+        ++_snapshot->refs;
+        return;
+    }
+    _snapshot = new Snapshot;
+    _snapshot->path = dir;
+    _snapshot->mtime = mtime;
+    _snapshot->refs = 1;
+    _dir = opendir(dir.c_str());
+    if (!_dir) _failed = true;
+}
+
+Autoindex::Job::~Job() {
+    if (_dir) closedir(_dir);
+    _release(_snapshot);
+}
+
+bool Autoindex::Job::failed() const { return _failed; }
+const std::string& Autoindex::Job::html() const { return _html; }
+
+bool Autoindex::Job::step(size_t budget) {
+    if (_state == STATE_SCAN) {
+        if (_dir && !_scan(budget)) return false;
+        if (_failed) {
+            _state = STATE_DONE;
+            return true;
+        }
+        _sort();
+        _renderHeader();
+        _state = STATE_RENDER;
+        return false;
+    }
+
+    if (_state == STATE_RENDER) {
+        const std::vector<size_t>& order = _snapshot->order[_query.sort];
+        for (size_t n = 0; n < budget && _cursor < _end; ++n, ++_cursor) {
+            size_t pos = _query.descending ? order.size() - 1 - _cursor : _cursor;
+            const Entry& entry = _snapshot->entries[order[pos]];
+            std::string suffix = entry.is_dir ? "/" : "";
+            char date[32];
+            struct tm tm;
+            gmtime_r(&entry.mtime, &tm);
+            strftime(date, sizeof(date), "%d-%b-%Y %H:%M", &tm);
+            std::stringstream line;
+            line << "<li><a href=\"" << htmlEscape(_uri) << urlEncode(entry.name) << suffix << "\">"
+                 << htmlEscape(entry.name) << suffix << "</a> " << date << " ";
+            if (entry.is_dir) line << "-";
+            else line << entry.size;
+            line << "</li>";
+            _html += line.str();
+        }
+        if (_cursor < _end) return false;
+        _renderFooter();
+        _snapshot->pages[_query.key()] = _html;
+        _state = STATE_DONE;
+    }
+    return true;
+}
+
+// Reads up to `budget` entries. Returns true once the directory is done.
+bool Autoindex::Job::_scan(size_t budget) {
+    for (size_t n = 0; n < budget; ++n) {
+        struct dirent* ent = readdir(_dir);
+        if (!ent) {
+            closedir(_dir);
+            _dir = NULL;
+            // A directory modified in the second the scan started may change
+            // again without its mtime moving, so that version is not cached.
+            if (_snapshot->mtime < _scanStart) _owner._store(_snapshot);
+            return true;
+        }
+        std::string name = ent->d_name;
+        if (name == "." || name == "..") continue;
+
+        Entry entry;
+        entry.name = name;
+        struct stat st;
+        if (fstatat(dirfd(_dir), ent->d_name, &st, 0) == 0) {
+            entry.is_dir = S_ISDIR(st.st_mode);
+            entry.size = st.st_size;
+            entry.mtime = st.st_mtime;
+        } else { // Dangling symlink or removed meanwhile
+            entry.is_dir = false;
+            entry.size = 0;
+            entry.mtime = 0;
+        }
+        _snapshot->entries.push_back(entry);
+    }
+    return false;
+}
+
+// Each sort order is built once per snapshot and shared by later requests.
+void Autoindex::Job::_sort() {
+    std::vector<size_t>& order = _snapshot->order[_query.sort];
+    if (order.size() != _snapshot->entries.size()) {
+        order.resize(_snapshot->entries.size());
+        for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+        EntryOrder cmp;
+        cmp.entries = &_snapshot->entries;
+        cmp.key = _query.sort;
+        std::sort(order.begin(), order.end(), cmp);
+    }
+
+    size_t total = order.size();
+    if (_query.page_size == 0) {
+        _cursor = 0;
+        _end = total;
+        return;
+    }
+    size_t pages = total ? (total + _query.page_size - 1) / _query.page_size : 1;
+    if (_query.page > pages) _query.page = pages;
+    _cursor = (_query.page - 1) * _query.page_size;
+    _end = std::min(total, _cursor + _query.page_size);
+}
+
+void Autoindex::Job::_renderHeader() {
+    std::string uri = htmlEscape(_uri);
+    _html = "<html><head><title>Index of " + uri + "</title></head><body><h1>Index of " + uri + "</h1><p>Sort by:";
+    for (int k = 0; k < SORT_KEY_COUNT; ++k) {
+        // Clicking the current key flips the order.
+        bool desc = (k == _query.sort) ? !_query.descending : false;
+        _html += std::string(" <a href=\"?sort=") + k_sort_names[k] + "&amp;order=" + (desc ? "desc" : "asc") + "\">"
+            + k_sort_names[k] + "</a>";
+    }
+    _html += "</p><hr><ul>";
+    if (_uri != "/") _html += "<li><a href=\"../\">../</a></li>";
+}
+
+void Autoindex::Job::_renderFooter() {
+    _html += "</ul><hr>";
+    if (_query.page_size > 0) {
+        size_t total = _snapshot->entries.size();
+        size_t pages = total ? (total + _query.page_size - 1) / _query.page_size : 1;
+        std::stringstream base;
+        base << "?sort=" << k_sort_names[_query.sort] << "&amp;order=" << (_query.descending ? "desc" : "asc") << "&amp;page=";
+        std::stringstream nav;
+        nav << "<p>";
+        if (_query.page > 1) nav << "<a href=\"" << base.str() << (_query.page - 1) << "\">Previous</a> ";
+        nav << "Page " << _query.page << " of " << pages;
+        if (_query.page < pages) nav << " <a href=\"" << base.str() << (_query.page + 1) << "\">Next</a>";
+        nav << "</p>";
+        _html += nav.str();
+    }
+    _html += "</body></html>";
+}
@@ -0,0 +1,128 @@
+#ifndef AUTOINDEX_HPP
+#define AUTOINDEX_HPP
+
+#include <sys/types.h>
+#include <dirent.h>
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// Directory listings for autoindex locations. A directory is scanned once
+// per version (its mtime) into a snapshot shared by every request listing
+// it; rendered pages are kept in the snapshot too. Scanning and rendering
+// run as jobs that do a bounded amount of work per event-loop iteration, so
+// a directory with 100k entries never stalls other clients.
+class Autoindex {
+public:
+    enum SortKey {
+        SORT_NAME,
+        SORT_SIZE,
+        SORT_MTIME,
+        SORT_KEY_COUNT
+    };
+
+    // What to list, parsed from "?sort=name|size|mtime&order=asc|desc&page=N".
+    struct Query {
+        SortKey sort;
+        bool descending;
+        size_t page;      // 1-based
+        size_t page_size; // 0 lists everything on one page
+
+        Query() : sort(SORT_NAME), descending(false), page(1), page_size(0) {}
+        static Query parse(const std::string& query_string, size_t page_size);
+        std::string key() const;
+    };
+
+    struct Entry {
+        std::string name;
+        bool is_dir;
+        off_t size;
+        time_t mtime;
+    };
+
+    // One scanned version of a directory. Refcounted: held by the cache and
+    // by each job rendering from it, freed with the last reference.
+    struct Snapshot {
+        std::string path;
+        time_t mtime;
+        std::vector<Entry> entries; // In readdir order
+        std::vector<size_t> order[SORT_KEY_COUNT]; // Built on first use
+        std::map<std::string, std::string> pages;  // Rendered pages by Query::key()
+        int refs;
+    };
+
+    class Job;
+
+    Autoindex(size_t max_dirs);
+    ~Autoindex();
+
+    // Rendered page for `dir` if its current version was listed that way before.
+    const std::string* findPage(const std::string& dir, time_t mtime, const Query& query);
+    // Starts listing `dir` (whose mtime is `mtime`) as seen at `uri`.
+    Job* start(const std::string& dir, time_t mtime, const std::string& uri, const Query& query);
+
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+
+private:
+    typedef std::list<Snapshot*> SnapshotList;
+
+    Autoindex(const Autoindex&);
+    Autoindex& operator=(const Autoindex&);
+
+    Snapshot* _find(const std::string& dir, time_t mtime);
+    void _store(Snapshot* snapshot);
+    static void _release(Snapshot* snapshot);
+
+    size_t _max_dirs;
+    SnapshotList _lru; // Most recently used first
+    unsigned long _hits;
+    unsigned long _misses;
+
+    friend class Job;
+};
+
+class Autoindex::Job {
+public:
+    ~Job();
+
+    // Does at most `budget` entries worth of scanning or rendering. Returns
+    // true once the page is ready (or the directory could not be read).
+    bool step(size_t budget);
+    bool failed() const;
+    const std::string& html() const;
+
+private:
+    friend class Autoindex;
+    Job(Autoindex& owner, const std::string& dir, time_t mtime, const std::string& uri, const Query& query);
+
+    Job(const Job&);
+    Job& operator=(const Job&);
+
+    bool _scan(size_t budget);
+    void _sort();
+    void _renderHeader();
+    void _renderFooter();
+
+    enum State {
+        STATE_SCAN,
+        STATE_RENDER,
+        STATE_DONE
+    };
+
+    Autoindex& _owner;
+    std::string _uri;
+    Query _query;
+    Snapshot* _snapshot;
+    DIR* _dir;
+    time_t _scanStart;
+    State _state;
+    bool _failed;
+    size_t _cursor; // Next position in the page being rendered
+    size_t _end;
+    std::string _html;
+};
+
+#endif // AUTOINDEX_HPP
@@ -0,0 +1,153 @@
+#include "ByteScan.hpp"
+
+#include <cstring> // For memcmp
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BYTE_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char* (*FindFn)(const char*, const char*, char);
+typedef const char* (*FindEitherFn)(const char*, const char*, char, char);
+
+struct Kernels {
+    FindFn find;
+    FindEitherFn find_either;
+};
+
+static const char* scalarFind(const char* p, const char* end, char c) {
+    for (; p < end; ++p) {
+        if (*p == c) return p;
+    }
+    return NULL;
+}
+
+static const char* scalarFindEither(const char* p, const char* end, char a, char b) {
+    for (; p < end; ++p) {
+        if (*p == a || *p == b) return p;
+    }
+    return NULL;
+}
+
+#ifdef BYTE_SCAN_X86
+// The vector loops stop short of the end rather than read past it; the
+// remaining 0-15 (or 0-31) bytes go through the scalar loop.
+__attribute__((target("sse2")))
+static const char* sse2Find(const char* p, const char* end, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return scalarFind(p, end, c);
+}
+
+__attribute__((target("sse2")))
+static const char* sse2FindEither(const char* p, const char* end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return scalarFindEither(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char* avx2Find(const char* p, const char* end, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return sse2Find(p, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char* avx2FindEither(const char* p, const char* end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(block, va), _mm256_cmpeq_epi8(block, vb));
+        unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(hits));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return sse2FindEither(p, end, a, b);
+}
+#endif
+
+static const Kernels k_kernels[] = {
+    { scalarFind, scalarFindEither },
+#ifdef BYTE_SCAN_X86
+    { sse2Find, sse2FindEither },
+    { avx2Find, avx2FindEither },
+#endif
+};
+
+static bool supported(ByteScan::Kernel kernel) {
+#ifdef BYTE_SCAN_X86
+    __builtin_cpu_init();
+    if (kernel == ByteScan::KERNEL_AVX2) return __builtin_cpu_supports("avx2");
+    if (kernel == ByteScan::KERNEL_SSE2) return __builtin_cpu_supports("sse2");
+#endif
+    return kernel == ByteScan::KERNEL_SCALAR;
+}
+
+static ByteScan::Kernel g_kernel = ByteScan::best();
+static Kernels g_active = k_kernels[g_kernel];
+
+ByteScan::Kernel ByteScan::best() {
+    if (supported(KERNEL_AVX2)) return KERNEL_AVX2;
+    if (supported(KERNEL_SSE2)) return KERNEL_SSE2;
+    return KERNEL_SCALAR;
+}
+
+ByteScan::Kernel ByteScan::current() {
+    return g_kernel;
+}
+
+bool ByteScan::select(const std::string& name) {
+    Kernel kernel;
+    if (name == "avx2") kernel = KERNEL_AVX2;
+    else if (name == "sse2") kernel = KERNEL_SSE2;
+    else if (name == "scalar") kernel = KERNEL_SCALAR;
+    else return false;
+    if (!supported(kernel)) return false;
+    g_kernel = kernel;
+    g_active = k_kernels[kernel];
+    return true;
+}
+
+const char* ByteScan::name(Kernel kernel) {
+    switch (kernel) {
+        case KERNEL_AVX2: return "avx2";
+        case KERNEL_SSE2: return "sse2";
+        default: return "scalar";
+    }
+}
+
+const char* ByteScan::find(const char* p, const char* end, char c) {
+    return g_active.find(p, end, c);
+}
+
+const char* ByteScan::findEither(const char* p, const char* end, char a, char b) {
+    return g_active.find_either(p, end, a, b);
+}
+
+// Candidates come from the first-byte kernel; each is confirmed with memcmp.
+const char* ByteScan::findString(const char* p, const char* end, const std::string& needle) {
+    size_t n = needle.length();
+    if (n == 0) return p;
+    if (static_cast<size_t>(end - p) < n) return NULL;
+    const char* last = end - n + 1; // A match must start before this
+    while ((p = g_active.find(p, last, needle[0])) != NULL) {
+        if (std::memcmp(p + 1, needle.data() + 1, n - 1) == 0) return p;
+        ++p;
+    }
+    return NULL;
+}
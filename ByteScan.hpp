@@ -0,0 +1,32 @@
+#ifndef BYTE_SCAN_HPP
+#define BYTE_SCAN_HPP
+
+#include <string>
+
+// Delimiter search for the request parser, 16 (SSE2) or 32 (AVX2) bytes
+// per step. The kernel is picked at startup from what the CPU supports;
+// other platforms, and CPUs without either, use the scalar loop.
+class ByteScan {
+public:
+    enum Kernel {
+        KERNEL_SCALAR,
+        KERNEL_SSE2,
+        KERNEL_AVX2
+    };
+
+    // First `c` in [p, end), or NULL.
+    static const char* find(const char* p, const char* end, char c);
+    // First `a` or `b` (say CR or LF) in [p, end), or NULL.
+    static const char* findEither(const char* p, const char* end, char a, char b);
+    // First occurrence of `needle` in [p, end), or NULL.
+    static const char* findString(const char* p, const char* end, const std::string& needle);
+
+    static Kernel best();
+    static Kernel current();
+    // Forces a kernel ("avx2", "sse2" or "scalar"). Returns false if the
+    // name is unknown or this CPU cannot run it.
+    static bool select(const std::string& name);
+    static const char* name(Kernel kernel);
+};
+
+#endif // BYTE_SCAN_HPP
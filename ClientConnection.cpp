@@ -1,5 +1,10 @@
 // C system headers first
 #include <unistd.h> // Para read
+#include <sys/socket.h> // For send
+#include <cerrno>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include <cstdlib> // para strtol
 #include <cstring> // For strerror
 
@@ -18,14 +23,37 @@
 
  ClientConnection::ClientConnection(int client_fd) :
      _fd(client_fd), // Corrected
+    _shared(NULL),
+    _sharedSent(0),
+    _sharedEnd(0),
+    _file(NULL),
+    _fileRemaining(0),
+    _put(NULL),
      _cgiPid(0), // Corrected
     _cgiPipeFd(-1), // Corrected
-    _cgiLocation(NULL) // Corrected
+    _cgiStdinFd(-1),
+    _cgiLocation(NULL), // Corrected
+    _location(NULL),
+    _timeoutKind(TIMEOUT_NONE),
+    _requestStart(TimerWheel::nowMs()),
+    _requestBytes(0),
+    _heldBytes(0),
+    _inputPos(0),
+    _closeAfterWrite(false),
+    _bodyAdmitted(false),
+    _headOnly(false)
  {
      _parser = new HttpRequestParser(); // Initialize _parser
+     _timer.fd = client_fd;
  }
 
+size_t ClientConnection::_pendingBytes = 0;
+
 ClientConnection::~ClientConnection() {
+    _pendingBytes -= _heldBytes + (_input.size() - _inputPos) + _responseBuffer.size();
+    closeFileBody();
+    delete _put;
+    SharedBuffer::release(_shared);
     delete _parser; // Delete _parser
 }
 
@@ -33,7 +61,7 @@ int ClientConnection::getFd() const {
     return _fd; // Corrected
 }
 
-// Lê dados do socket e anexa ao buffer interno
+// Lê dados do socket e anexa ao buffer de entrada; o parse é feito por parseInput()
 ssize_t ClientConnection::readRequest() {
     char buffer[4096];
     ssize_t bytes_read = read(_fd, buffer, sizeof(buffer)); // Corrected
@@ -42,11 +70,72 @@ ssize_t ClientConnection::readRequest() {
         return bytes_read;
     }
 
-    std::string data_chunk(buffer, bytes_read);
-    _parser->parse(data_chunk); // Feed data to the parser
-
+    _input.append(buffer, bytes_read);
+    _pendingBytes += bytes_read;
     return bytes_read;
 }
+
+// Feeds buffered input to the current parser. Whatever it does not consume
+// (the start of the next pipelined request) stays buffered for the parser
+// that replaceParser() installs.
+size_t ClientConnection::parseInput() {
+    if (_inputPos == _input.size()) {
+        return 0;
+    }
+    size_t streamed = _parser->getStreamedBytes();
+    size_t consumed = _parser->parse(_input.data() + _inputPos, _input.size() - _inputPos);
+    if (consumed > 0 && _requestStart == 0) { // First byte of a new request on a kept-alive connection
+        _requestStart = TimerWheel::nowMs();
+    }
+    consumeInput(consumed);
+    // File parts written to disk no longer count as buffered; the parser
+    // may stream bytes it kept from an earlier call, hence the order.
+    size_t held = _heldBytes + consumed - (_parser->getStreamedBytes() - streamed);
+    _pendingBytes += held;
+    _pendingBytes -= _heldBytes;
+    _heldBytes = held;
+    return consumed;
+}
+
+const char* ClientConnection::getBufferedData() const {
+    return _input.data() + _inputPos;
+}
+
+// Takes `len` bytes off the input. They stop counting as pending: what the
+// parser keeps is added back by parseInput(), a PUT body went to its file.
+void ClientConnection::consumeInput(size_t len) {
+    _requestBytes += len;
+    _pendingBytes -= len;
+    _inputPos += len;
+    if (_inputPos == _input.size()) {
+        _input.clear();
+        _inputPos = 0;
+    } else if (_inputPos >= 4096 && _inputPos * 2 >= _input.size()) {
+        _input.erase(0, _inputPos); // Compact once the consumed prefix dominates
+        _inputPos = 0;
+    }
+}
+
+void ClientConnection::finishBody() {
+    _parser->skipBody();
+}
+
+void ClientConnection::setPut(PutUpload* put) {
+    delete _put;
+    _put = put;
+}
+
+PutUpload* ClientConnection::getPut() const {
+    return _put;
+}
+
+bool ClientConnection::hasBufferedInput() const {
+    return _inputPos < _input.size();
+}
+
+size_t ClientConnection::getBufferedInput() const {
+    return _input.size() - _inputPos;
+}
 // Retorna o buffer com os dados da requisição
 const HttpRequest& ClientConnection::getRequest() const {
     return _parser->getRequest();
@@ -55,20 +144,45 @@ const HttpRequest& ClientConnection::getRequest() const {
 void ClientConnection::replaceParser() {
     delete _parser;
     _parser = new HttpRequestParser();
+    _requestStart = 0;
+    _pendingBytes -= _heldBytes;
+    _heldBytes = 0;
+    _requestBytes = 0;
+    _bodyAdmitted = false;
+}
+
+int ClientConnection::getParseError() const {
+    if (_parser->getState() != HttpRequestParser::PARSING_ERROR) return 0;
+    return _parser->getErrorStatus();
+}
+
+void ClientConnection::admitBody(size_t limit) {
+    _parser->setBodyLimit(limit);
+    _bodyAdmitted = true;
+}
+
+bool ClientConnection::isBodyAdmitted() const {
+    return _bodyAdmitted;
 }
 
 size_t ClientConnection::getRequestBufferSize() const {
     if (_parser) {
-        return _parser->getRequest().getBody().length();
+        return _parser->getBodySize();
     }
     return 0; // Or throw an error, depending on desired behavior
 }
 
+void ClientConnection::setUploadDir(const std::string& dir) {
+    _parser->setUploadDir(dir);
+}
+
 bool ClientConnection::isRequestComplete() const {
     return _parser->getState() == HttpRequestParser::PARSING_COMPLETE;
 }
 
 void ClientConnection::setResponse(const std::string& response) {
+    _pendingBytes += response.size();
+    _pendingBytes -= _responseBuffer.size();
     _responseBuffer = response;
 }
 
@@ -77,9 +191,125 @@ const std::string& ClientConnection::getResponseBuffer() const {
 }
 
 void ClientConnection::clearResponseBuffer() {
+    _pendingBytes -= _responseBuffer.size();
     _responseBuffer.clear();
 }
 
+void ClientConnection::setSharedResponse(SharedBuffer* buffer) {
+    clearResponseBuffer();
+    closeFileBody();
+    setPut(NULL);
+    SharedBuffer::release(_shared);
+    _shared = buffer;
+    _sharedSent = 0;
+    _sharedEnd = buffer ? buffer->data().size() : 0;
+}
+
+size_t ClientConnection::getSharedRemaining() const {
+    return _shared ? _sharedEnd - _sharedSent : 0;
+}
+
+// Sends what is left of the shared response; the reference is dropped once
+// all of it went out.
+ssize_t ClientConnection::sendSharedResponse() {
+    const std::string& data = _shared->data();
+    ssize_t sent = send(_fd, data.data() + _sharedSent, _sharedEnd - _sharedSent, 0);
+    if (sent < 0) return sent;
+    _sharedSent += static_cast<size_t>(sent);
+    if (_sharedSent == _sharedEnd) {
+        SharedBuffer::release(_shared);
+        _shared = NULL;
+    }
+    return sent;
+}
+
+void ClientConnection::setFileBody(OpenFileCache::File* file, off_t offset, size_t length) {
+    closeFileBody();
+    _file = file;
+    addFileSegment("", offset, length);
+}
+
+void ClientConnection::addFileSegment(const std::string& prefix, off_t offset, size_t length) {
+    if (prefix.empty() && length == 0) return;
+    FileSegment segment;
+    segment.prefix = prefix;
+    segment.offset = offset;
+    segment.length = length;
+    _fileSegments.push_back(segment);
+    _fileRemaining += prefix.size() + length;
+}
+
+size_t ClientConnection::getFileRemaining() const {
+    return _fileRemaining;
+}
+
+// Sends the next part of the file body: the current segment's prefix, then
+// its file range straight from the page cache, advancing the offset on
+// partial writes. Returns what send()/sendfile() returned; the file is
+// released once everything went out.
+ssize_t ClientConnection::sendFileBody() {
+    FileSegment& segment = _fileSegments.front();
+    ssize_t sent;
+    if (!segment.prefix.empty()) {
+        sent = send(_fd, segment.prefix.data(), segment.prefix.size(), 0);
+        if (sent < 0) return sent;
+        segment.prefix.erase(0, sent);
+    } else {
+#ifdef __linux__
+        sent = sendfile(_fd, _file->fd, &segment.offset, segment.length);
+        if (sent < 0) return sent;
+#else
+        char buffer[65536];
+        size_t chunk = segment.length < sizeof(buffer) ? segment.length : sizeof(buffer);
+        ssize_t n = pread(_file->fd, buffer, chunk, segment.offset);
+        if (n <= 0) {
+            if (n == 0) errno = EIO; // File shrank under us
+            return -1;
+        }
+        sent = send(_fd, buffer, n, 0);
+        if (sent < 0) return sent;
+        segment.offset += sent;
+#endif
+        if (sent == 0) { // File shrank under us
+            errno = EIO;
+            return -1;
+        }
+        segment.length -= static_cast<size_t>(sent);
+    }
+    _fileRemaining -= static_cast<size_t>(sent);
+    if (segment.prefix.empty() && segment.length == 0) _fileSegments.pop_front();
+    if (_fileRemaining == 0) closeFileBody();
+    return sent;
+}
+
+void ClientConnection::closeFileBody() {
+    OpenFileCache::release(_file);
+    _file = NULL;
+    _fileSegments.clear();
+    _fileRemaining = 0;
+}
+
+void ClientConnection::setHeadOnly(bool head_only) {
+    _headOnly = head_only;
+}
+
+// Every response starts in the response buffer or the shared buffer; the
+// file body, if any, is all body.
+void ClientConnection::dropHeadBody() {
+    if (!_headOnly) return;
+    _headOnly = false;
+    size_t end = _responseBuffer.find("\r\n\r\n");
+    if (end != std::string::npos) {
+        _pendingBytes -= _responseBuffer.size() - (end + 4);
+        _responseBuffer.resize(end + 4);
+    }
+    if (_shared) {
+        end = _shared->data().find("\r\n\r\n");
+        if (end != std::string::npos) _sharedEnd = end + 4;
+    }
+    closeFileBody();
+}
+
 // CGI-related methods
 void ClientConnection::setCgiPid(pid_t pid) {
     _cgiPid = pid; // Corrected
@@ -97,6 +327,14 @@ int ClientConnection::getCgiPipeFd() const {
     return _cgiPipeFd; // Corrected
 }
 
+void ClientConnection::setCgiStdinFd(int fd) {
+    _cgiStdinFd = fd;
+}
+
+int ClientConnection::getCgiStdinFd() const {
+    return _cgiStdinFd;
+}
+
 void ClientConnection::setCgiLocation(const LocationConfig* loc) {
     _cgiLocation = loc; // Corrected
 }
@@ -104,3 +342,53 @@ void ClientConnection::setCgiLocation(const LocationConfig* loc) {
 const LocationConfig* ClientConnection::getCgiLocation() const {
     return _cgiLocation; // Corrected
 }
+
+void ClientConnection::setLocation(const LocationConfig* loc) {
+    _location = loc;
+}
+
+const LocationConfig* ClientConnection::getLocation() const {
+    return _location;
+}
+
+// Timeout bookkeeping
+TimerWheel::Timer* ClientConnection::getTimer() {
+    return &_timer;
+}
+
+ClientConnection::TimeoutKind ClientConnection::getTimeoutKind() const {
+    return _timeoutKind;
+}
+
+void ClientConnection::setTimeoutKind(TimeoutKind kind) {
+    _timeoutKind = kind;
+}
+
+unsigned long ClientConnection::getRequestStart() const {
+    return _requestStart;
+}
+
+size_t ClientConnection::getRequestBytes() const {
+    return _requestBytes;
+}
+
+bool ClientConnection::isParsingBody() const {
+    HttpRequestParser::ParsingState state = _parser->getState();
+    return state == HttpRequestParser::PARSING_BODY
+        || state == HttpRequestParser::PARSING_CHUNKED_BODY
+        || state == HttpRequestParser::PARSING_MULTIPART_BODY;
+}
+
+void ClientConnection::setCloseAfterWrite(bool close) {
+    _closeAfterWrite = close;
+}
+
+bool ClientConnection::shouldCloseAfterWrite() const {
+    return _closeAfterWrite;
+}
+
+// Bytes buffered by all connections of this process: requests being read
+// plus responses waiting to be sent. Used for overload shedding.
+size_t ClientConnection::getPendingBytes() {
+    return _pendingBytes;
+}
@@ -1,43 +1,144 @@
 #ifndef CLIENT_CONNECTION_HPP
 #define CLIENT_CONNECTION_HPP
 
+#include <sys/types.h> // For ssize_t, pid_t
+#include <deque>
+
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
+#include "TimerWheel.hpp"
+#include "OpenFileCache.hpp"
+#include "SharedBuffer.hpp"
+#include "PutUpload.hpp"
 
 class HttpRequestParser; // Forward declaration
 struct LocationConfig;    // Forward declaration for LocationConfig (changed to struct)
 
 class ClientConnection {
 public:
+    // Which deadline the connection's timer currently tracks.
+    enum TimeoutKind {
+        TIMEOUT_NONE,
+        TIMEOUT_HEADER,    // Request line and headers must arrive in time
+        TIMEOUT_BODY,      // Maximum gap between two reads of the body
+        TIMEOUT_KEEPALIVE, // Idle time between requests
+        TIMEOUT_SEND       // Maximum gap between two successful writes
+    };
+
     ClientConnection(int fd);
     ~ClientConnection();
 
     int getFd() const;
     ssize_t readRequest();
+    size_t parseInput();
+    bool hasBufferedInput() const;
+    size_t getBufferedInput() const;
+    // Unparsed input handed to something other than the parser (a PUT body)
+    const char* getBufferedData() const;
+    void consumeInput(size_t len);
+    // The body was taken off the connection by the caller: the request is
+    // complete without it.
+    void finishBody();
     bool isRequestComplete() const;
+    int getParseError() const; // Status to answer a malformed request with, else 0
+    // The body was accepted on the strength of the head: it may grow up to
+    // `limit`. Cleared by replaceParser().
+    void admitBody(size_t limit);
+    bool isBodyAdmitted() const;
     const HttpRequest& getRequest() const;
     size_t getRequestBufferSize() const; // Re-add this declaration
     void replaceParser();
+    void setUploadDir(const std::string& dir);
     void setResponse(const std::string& response);
     const std::string& getResponseBuffer() const;
     void clearResponseBuffer();
 
+    // Prebuilt response sent straight from a shared buffer (error replies).
+    // Replaces any pending response; the connection takes over the caller's
+    // reference.
+    void setSharedResponse(SharedBuffer* buffer);
+    size_t getSharedRemaining() const;
+    ssize_t sendSharedResponse();
+
+    // File-backed body, sent with sendfile() after the response buffer.
+    // The connection takes over the caller's hold on the file. Further segments (each an
+    // in-memory prefix followed by a file range) can be appended, which is
+    // how multipart/byteranges bodies are built.
+    void setFileBody(OpenFileCache::File* file, off_t offset, size_t length);
+    void addFileSegment(const std::string& prefix, off_t offset, size_t length);
+    size_t getFileRemaining() const;
+    ssize_t sendFileBody();
+    void closeFileBody();
+
+    // Raw PUT body being received; the connection owns it
+    void setPut(PutUpload* put);
+    PutUpload* getPut() const;
+
     // For CGI
     void setCgiPid(pid_t pid);
     pid_t getCgiPid() const;
     void setCgiPipeFd(int fd);
     int getCgiPipeFd() const;
+    void setCgiStdinFd(int fd);
+    int getCgiStdinFd() const;
     void setCgiLocation(const LocationConfig* loc); // Forward declare LocationConfig
     const LocationConfig* getCgiLocation() const;
 
+    // Location matched for the request currently being served
+    void setLocation(const LocationConfig* loc);
+    const LocationConfig* getLocation() const;
+
+    // Timeouts
+    TimerWheel::Timer* getTimer();
+    TimeoutKind getTimeoutKind() const;
+    void setTimeoutKind(TimeoutKind kind);
+    unsigned long getRequestStart() const;
+    size_t getRequestBytes() const;
+    bool isParsingBody() const;
+    void setCloseAfterWrite(bool close);
+    bool shouldCloseAfterWrite() const;
+    // HEAD: the response is sent without its body. dropHeadBody() cuts the
+    // queued response down to its headers and clears the flag.
+    void setHeadOnly(bool head_only);
+    void dropHeadBody();
+
+    static size_t getPendingBytes();
+
 private:
     int _fd;
     std::string _requestBuffer;
     std::string _responseBuffer;
+    struct FileSegment {
+        std::string prefix;
+        off_t offset;
+        size_t length;
+    };
+
+    SharedBuffer* _shared;
+    size_t _sharedSent;
+    size_t _sharedEnd; // Where sending stops: the end, or the headers' for HEAD
+    OpenFileCache::File* _file;
+    std::deque<FileSegment> _fileSegments;
+    size_t _fileRemaining; // Across all segments, prefixes included
     HttpRequestParser* _parser; // Use pointer
+    PutUpload* _put;
     pid_t _cgiPid;
     int _cgiPipeFd;
+    int _cgiStdinFd;
     const LocationConfig* _cgiLocation;
+    const LocationConfig* _location;
+    TimerWheel::Timer _timer;
+    TimeoutKind _timeoutKind;
+    unsigned long _requestStart; // Monotonic ms of the first byte of the current request
+    size_t _requestBytes;        // Bytes of the current request taken off the input
+    size_t _heldBytes;           // Of those, the ones still in memory
+    std::string _input;          // Bytes read but not yet parsed (pipelined requests)
+    size_t _inputPos;
+    bool _closeAfterWrite;
+    bool _bodyAdmitted;
+    bool _headOnly;
+
+    static size_t _pendingBytes;
 };
 
 #endif // CLIENT_CONNECTION_HPP
@@ -5,6 +5,7 @@
 #include <stdexcept>
 #include <cstdlib>
 #include <cctype>
+#include <sys/socket.h> // For SOMAXCONN
 
 static std::string trim(const std::string& s) {
     const std::string whitespace = " \t\n\r";
@@ -14,7 +15,14 @@ static std::string trim(const std::string& s) {
     return s.substr(start, end - start + 1);
 }
 
-ConfigParser::ConfigParser(const std::string& filePath) : _filePath(filePath), _root("./www") {
+ConfigParser::ConfigParser(const std::string& filePath) : _filePath(filePath), _root("./www"), _worker_processes(1), _listen_backlog(SOMAXCONN), _accept_batch(64),
+    _max_connections(0), _max_pending_bytes(0), _overload_watermark(90),
+    _client_header_timeout(60000), _client_body_timeout(60000), _keepalive_timeout(75000), _send_timeout(60000),
+    _file_cache_size(16 * 1024 * 1024), _file_cache_max_file(1024 * 1024), _file_cache_valid(1000),
+    _gzip_static_build(false), _gzip_static_threads(2), _gzip_cache_size(1024 * 1024),
+    _autoindex_cache_dirs(32), _path_cache_size(4096), _path_cache_valid(10000), _path_cache_inotify(true),
+    _open_file_cache_max(256), _open_file_cache_inactive(20000), _open_file_cache_valid(1000),
+    _client_max_header_size(16 * 1024), _client_max_headers(100) {
     parse();
 }
 
@@ -46,6 +54,84 @@ size_t ConfigParser::_parseSize(const std::string& size_str) {
     return num_val;
 }
 
+// Directives that apply to the whole process rather than a server block.
+// They are accepted both at the top level and inside the server block.
+bool ConfigParser::_parseGlobalDirective(const std::string& directive, const std::string& value) {
+    if (directive == "worker_processes") {
+        _worker_processes = _parsePositiveInt(directive, value, 512);
+    } else if (directive == "listen_backlog") {
+        _listen_backlog = _parsePositiveInt(directive, value, 65535);
+    } else if (directive == "accept_batch") {
+        _accept_batch = _parsePositiveInt(directive, value, 65535);
+    } else if (directive == "max_connections") {
+        _max_connections = _parsePositiveInt(directive, value, 10000000);
+    } else if (directive == "max_pending_bytes") {
+        _max_pending_bytes = _parseSize(value);
+    } else if (directive == "overload_watermark") {
+        _overload_watermark = _parsePositiveInt(directive, value, 100);
+    } else if (directive == "gzip_static_build") {
+        if (value != "on" && value != "off") {
+            throw std::runtime_error("Invalid value for gzip_static_build. Use 'on' or 'off'.");
+        }
+        _gzip_static_build = (value == "on");
+    } else if (directive == "gzip_static_threads") {
+        _gzip_static_threads = _parsePositiveInt(directive, value, 64);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Durations accept nginx-style suffixes: "500ms", "30s", "5m", "1h".
+// A bare number is in seconds.
+long ConfigParser::_parseTime(const std::string& directive, const std::string& value) {
+    char* end = NULL;
+    long n = std::strtol(value.c_str(), &end, 10);
+    std::string unit(end);
+    if (value.empty() || end == value.c_str() || n < 0) {
+        throw std::runtime_error("Invalid value for " + directive + ".");
+    }
+    if (unit == "ms") return n;
+    if (unit.empty() || unit == "s") return n * 1000;
+    if (unit == "m") return n * 60 * 1000;
+    if (unit == "h") return n * 60 * 60 * 1000;
+    throw std::runtime_error("Invalid time unit for " + directive + ". Use ms, s, m or h.");
+}
+
+int ConfigParser::_parsePositiveInt(const std::string& directive, const std::string& value, long max) {
+    char* end = NULL;
+    long n = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end || n < 1 || n > max) {
+        std::stringstream msg;
+        msg << "Invalid value for " << directive << ". Use a number between 1 and " << max << ".";
+        throw std::runtime_error(msg.str());
+    }
+    return static_cast<int>(n);
+}
+
+// open_file_cache off | max=N [inactive=time]
+void ConfigParser::_parseOpenFileCache(const std::string& line) {
+    std::stringstream ss(line);
+    std::string directive, param;
+    ss >> directive;
+    bool has_max = false;
+    while (ss >> param) {
+        if (!param.empty() && param[param.length() - 1] == ';') param.erase(param.length() - 1);
+        if (param == "off") {
+            _open_file_cache_max = 0;
+            return;
+        } else if (param.compare(0, 4, "max=") == 0) {
+            _open_file_cache_max = _parsePositiveInt("open_file_cache max", param.substr(4), 1000000);
+            has_max = true;
+        } else if (param.compare(0, 9, "inactive=") == 0) {
+            _open_file_cache_inactive = _parseTime("open_file_cache inactive", param.substr(9));
+        } else if (!param.empty()) {
+            throw std::runtime_error("Invalid parameter for open_file_cache: " + param);
+        }
+    }
+    if (!has_max) throw std::runtime_error("open_file_cache requires 'max=N' or 'off'.");
+}
+
 void ConfigParser::parse() {
     std::ifstream configFile(_filePath.c_str());
     if (!configFile.is_open()) throw std::runtime_error("Could not open file");
@@ -59,7 +145,17 @@ void ConfigParser::parse() {
         if (trimmedLine.empty() || trimmedLine[0] == '#') continue;
 
         if (!in_server_block) {
-            if (trimmedLine == "server {") in_server_block = true;
+            if (trimmedLine == "server {") {
+                in_server_block = true;
+            } else {
+                std::stringstream ss(trimmedLine);
+                std::string directive, value;
+                ss >> directive >> value;
+                if (!value.empty() && value[value.length() - 1] == ';') {
+                    value.erase(value.length() - 1);
+                }
+                _parseGlobalDirective(directive, value);
+            }
             continue;
         }
 
@@ -73,7 +169,19 @@ void ConfigParser::parse() {
             std::string keyword, path;
             ss >> keyword >> path;
             LocationConfig* new_loc = new LocationConfig();
+            if (path == "=" || path == "^~" || path == "~" || path == "~*") {
+                if (path == "=") new_loc->match = LocationConfig::MATCH_EXACT;
+                else if (path == "^~") new_loc->match = LocationConfig::MATCH_PREFIX_NO_REGEX;
+                else if (path == "~") new_loc->match = LocationConfig::MATCH_REGEX;
+                else new_loc->match = LocationConfig::MATCH_REGEX_ICASE;
+                ss >> path;
+            }
+            if (path.empty() || path == "{") {
+                delete new_loc;
+                throw std::runtime_error("Missing path for location: " + trimmedLine);
+            }
             new_loc->path = path;
+            new_loc->id = _locations.size();
             _locations.push_back(new_loc);
             current_location = new_loc;
             continue;
@@ -93,7 +201,16 @@ void ConfigParser::parse() {
 
         if (current_location) {
             if (directive == "root") current_location->root = value;
-            else if (directive == "index") current_location->index = value;
+            else if (directive == "index") {
+                std::stringstream value_ss(trimmedLine);
+                std::string name;
+                value_ss >> name; // consume "index"
+                current_location->index.clear();
+                while (value_ss >> name) {
+                    if (!name.empty() && name[name.length() - 1] == ';') name.erase(name.length() - 1);
+                    if (!name.empty()) current_location->index.push_back(name);
+                }
+            }
             else if (directive == "cgi_path") current_location->cgi_path = value;
             else if (directive == "cgi_ext") current_location->cgi_ext = value;
             else if (directive == "client_max_body_size") current_location->client_max_body_size = _parseSize(value);
@@ -122,6 +239,14 @@ void ConfigParser::parse() {
                 current_location->redirect = value;
             } else if (directive == "upload_path") {
                 current_location->upload_path = value;
+            } else if (directive == "client_header_timeout") {
+                current_location->client_header_timeout = _parseTime(directive, value);
+            } else if (directive == "client_body_timeout") {
+                current_location->client_body_timeout = _parseTime(directive, value);
+            } else if (directive == "keepalive_timeout") {
+                current_location->keepalive_timeout = _parseTime(directive, value);
+            } else if (directive == "send_timeout") {
+                current_location->send_timeout = _parseTime(directive, value);
             } else if (directive == "autoindex") {
                 if (value == "on") {
                     current_location->autoindex = true;
@@ -130,10 +255,84 @@ void ConfigParser::parse() {
                 } else {
                     throw std::runtime_error("Invalid value for autoindex. Use 'on' or 'off'.");
                 }
+            } else if (directive == "expires") {
+                current_location->expires = (value == "off") ? -1 : _parseTime(directive, value) / 1000;
+            } else if (directive == "cache_control") {
+                std::string rest = trim(trimmedLine.substr(directive.length()));
+                if (!rest.empty() && rest[rest.length() - 1] == ';') {
+                    rest = trim(rest.substr(0, rest.length() - 1));
+                }
+                current_location->cache_control = rest;
+            } else if (directive == "autoindex_page_size") {
+                current_location->autoindex_page_size = std::strtoul(value.c_str(), NULL, 10);
+            } else if (directive == "gzip_static") {
+                if (value != "on" && value != "off") {
+                    throw std::runtime_error("Invalid value for gzip_static. Use 'on' or 'off'.");
+                }
+                current_location->gzip_static = (value == "on");
+            } else if (directive == "gzip") {
+                if (value != "on" && value != "off") {
+                    throw std::runtime_error("Invalid value for gzip. Use 'on' or 'off'.");
+                }
+                current_location->gzip = (value == "on");
+            } else if (directive == "gzip_comp_level") {
+                current_location->gzip_comp_level = _parsePositiveInt(directive, value, 9);
+            } else if (directive == "gzip_min_length") {
+                current_location->gzip_min_length = _parseSize(value);
+            } else if (directive == "gzip_types") {
+                std::stringstream value_ss(trimmedLine);
+                std::string temp_directive;
+                std::string type;
+                value_ss >> temp_directive; // consume "gzip_types"
+                while (value_ss >> type) {
+                    if (!type.empty() && type[type.length() - 1] == ';') {
+                        type.erase(type.length() - 1);
+                    }
+                    if (!type.empty()) current_location->gzip_types.push_back(type);
+                }
+            } else if (directive == "stats") {
+                if (value != "on" && value != "off") {
+                    throw std::runtime_error("Invalid value for stats. Use 'on' or 'off'.");
+                }
+                current_location->stats = (value == "on");
             }
         } else {
+            if (_parseGlobalDirective(directive, value)) continue;
             if (directive == "listen") _ports.push_back(std::atoi(value.c_str()));
             else if (directive == "root") _root = value;
+            else if (directive == "client_header_timeout") _client_header_timeout = _parseTime(directive, value);
+            else if (directive == "client_body_timeout") _client_body_timeout = _parseTime(directive, value);
+            else if (directive == "keepalive_timeout") _keepalive_timeout = _parseTime(directive, value);
+            else if (directive == "send_timeout") _send_timeout = _parseTime(directive, value);
+            else if (directive == "client_max_header_size") _client_max_header_size = _parseSize(value);
+            else if (directive == "client_max_headers") _client_max_headers = _parsePositiveInt(directive, value, 10000);
+            else if (directive == "file_cache_size") _file_cache_size = _parseSize(value);
+            else if (directive == "file_cache_max_file") _file_cache_max_file = _parseSize(value);
+            else if (directive == "file_cache_valid") _file_cache_valid = _parseTime(directive, value);
+            else if (directive == "gzip_cache_size") _gzip_cache_size = _parseSize(value);
+            else if (directive == "open_file_cache") _parseOpenFileCache(trimmedLine);
+            else if (directive == "open_file_cache_valid") _open_file_cache_valid = _parseTime(directive, value);
+            else if (directive == "path_cache_size") _path_cache_size = std::strtoul(value.c_str(), NULL, 10);
+            else if (directive == "path_cache_valid") _path_cache_valid = _parseTime(directive, value);
+            else if (directive == "path_cache_inotify") {
+                if (value != "on" && value != "off") {
+                    throw std::runtime_error("Invalid value for path_cache_inotify. Use 'on' or 'off'.");
+                }
+                _path_cache_inotify = (value == "on");
+            }
+            else if (directive == "autoindex_cache_dirs") _autoindex_cache_dirs = std::strtoul(value.c_str(), NULL, 10);
+            else if (directive == "event_backend") {
+                if (value != "epoll" && value != "select") {
+                    throw std::runtime_error("Invalid value for event_backend. Use 'epoll' or 'select'.");
+                }
+                _event_backend = value;
+            }
+            else if (directive == "scan_kernel") {
+                if (value != "avx2" && value != "sse2" && value != "scalar") {
+                    throw std::runtime_error("Invalid value for scan_kernel. Use 'avx2', 'sse2' or 'scalar'.");
+                }
+                _scan_kernel = value;
+            }
             else if (directive == "error_page") {
                 std::stringstream value_ss(trimmedLine);
                 std::string temp_directive;
@@ -148,9 +347,38 @@ void ConfigParser::parse() {
         }
     }
     if (_ports.empty()) throw std::runtime_error("Port not specified");
+    _router.build(_locations);
 }
 
 const std::vector<int>& ConfigParser::getPorts() const { return _ports; }
 const std::string& ConfigParser::getRoot() const { return _root; }
 const std::vector<LocationConfig*>& ConfigParser::getLocations() const { return _locations; }
+const LocationConfig* ConfigParser::findLocation(const std::string& uri) const { return _router.find(uri); }
 const std::map<int, std::string>& ConfigParser::getErrorPages() const { return _error_pages; }
+const std::string& ConfigParser::getEventBackend() const { return _event_backend; }
+const std::string& ConfigParser::getScanKernel() const { return _scan_kernel; }
+int ConfigParser::getWorkerProcesses() const { return _worker_processes; }
+int ConfigParser::getListenBacklog() const { return _listen_backlog; }
+int ConfigParser::getAcceptBatch() const { return _accept_batch; }
+size_t ConfigParser::getMaxConnections() const { return _max_connections; }
+size_t ConfigParser::getMaxPendingBytes() const { return _max_pending_bytes; }
+int ConfigParser::getOverloadWatermark() const { return _overload_watermark; }
+long ConfigParser::getClientHeaderTimeout() const { return _client_header_timeout; }
+long ConfigParser::getClientBodyTimeout() const { return _client_body_timeout; }
+long ConfigParser::getKeepaliveTimeout() const { return _keepalive_timeout; }
+long ConfigParser::getSendTimeout() const { return _send_timeout; }
+size_t ConfigParser::getFileCacheSize() const { return _file_cache_size; }
+size_t ConfigParser::getFileCacheMaxFile() const { return _file_cache_max_file; }
+long ConfigParser::getFileCacheValid() const { return _file_cache_valid; }
+bool ConfigParser::getGzipStaticBuild() const { return _gzip_static_build; }
+int ConfigParser::getGzipStaticThreads() const { return _gzip_static_threads; }
+size_t ConfigParser::getGzipCacheSize() const { return _gzip_cache_size; }
+size_t ConfigParser::getAutoindexCacheDirs() const { return _autoindex_cache_dirs; }
+size_t ConfigParser::getPathCacheSize() const { return _path_cache_size; }
+long ConfigParser::getPathCacheValid() const { return _path_cache_valid; }
+bool ConfigParser::getPathCacheInotify() const { return _path_cache_inotify; }
+size_t ConfigParser::getOpenFileCacheMax() const { return _open_file_cache_max; }
+long ConfigParser::getOpenFileCacheInactive() const { return _open_file_cache_inactive; }
+long ConfigParser::getOpenFileCacheValid() const { return _open_file_cache_valid; }
+size_t ConfigParser::getClientMaxHeaderSize() const { return _client_max_header_size; }
+size_t ConfigParser::getClientMaxHeaders() const { return _client_max_headers; }
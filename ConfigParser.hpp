@@ -5,6 +5,7 @@
 #include <vector>
 #include <map>
 #include "LocationConfig.hpp"
+#include "LocationRouter.hpp"
 
 class ConfigParser {
 public:
@@ -14,17 +15,84 @@ public:
     const std::vector<int>& getPorts() const;
     const std::string& getRoot() const;
     const std::vector<LocationConfig*>& getLocations() const;
+    // The location serving `uri`, or NULL if none matches.
+    const LocationConfig* findLocation(const std::string& uri) const;
     const std::map<int, std::string>& getErrorPages() const;
+    const std::string& getEventBackend() const;
+    const std::string& getScanKernel() const;
+    int getWorkerProcesses() const;
+    int getListenBacklog() const;
+    int getAcceptBatch() const;
+    size_t getMaxConnections() const;
+    size_t getMaxPendingBytes() const;
+    int getOverloadWatermark() const;
+    long getClientHeaderTimeout() const;
+    long getClientBodyTimeout() const;
+    long getKeepaliveTimeout() const;
+    long getSendTimeout() const;
+    size_t getFileCacheSize() const;
+    size_t getFileCacheMaxFile() const;
+    long getFileCacheValid() const;
+    bool getGzipStaticBuild() const;
+    int getGzipStaticThreads() const;
+    size_t getGzipCacheSize() const;
+    size_t getAutoindexCacheDirs() const;
+    size_t getPathCacheSize() const;
+    long getPathCacheValid() const;
+    bool getPathCacheInotify() const;
+    size_t getOpenFileCacheMax() const;
+    long getOpenFileCacheInactive() const;
+    long getOpenFileCacheValid() const;
+    size_t getClientMaxHeaderSize() const;
+    size_t getClientMaxHeaders() const;
 
 private:
     void parse();
     size_t _parseSize(const std::string& size_str);
+    bool _parseGlobalDirective(const std::string& directive, const std::string& value);
+    long _parseTime(const std::string& directive, const std::string& value);
+    int _parsePositiveInt(const std::string& directive, const std::string& value, long max);
+    void _parseOpenFileCache(const std::string& line);
 
     std::string _filePath;
     std::vector<int> _ports;
     std::string _root;
     std::vector<LocationConfig*> _locations;
+    LocationRouter _router; // Compiled from _locations once parsing is done
     std::map<int, std::string> _error_pages;
+    std::string _event_backend; // "epoll", "select" or empty for the platform default
+    std::string _scan_kernel;   // Parser delimiter kernel, empty for the best this CPU runs
+    int _worker_processes; // 1 keeps the single-process event loop
+    int _listen_backlog;
+    int _accept_batch; // Max connections accepted per listener wakeup
+    // Overload limits, per process (0 means unlimited)
+    size_t _max_connections;
+    size_t _max_pending_bytes;
+    int _overload_watermark; // Percent of max_connections where shedding starts
+    // Timeouts in milliseconds (0 disables)
+    long _client_header_timeout;
+    long _client_body_timeout;
+    long _keepalive_timeout;
+    long _send_timeout;
+    // In-memory static file cache (a size of 0 disables it)
+    size_t _file_cache_size;
+    size_t _file_cache_max_file; // Bigger files are streamed with sendfile()
+    long _file_cache_valid; // Milliseconds between stat() revalidations
+    bool _gzip_static_build; // Build missing sidecars for gzip_static locations at startup
+    int _gzip_static_threads;
+    size_t _gzip_cache_size; // Budget for compressed generated bodies
+    size_t _autoindex_cache_dirs; // Directory snapshots kept for autoindex (0 disables)
+    // GET path resolution cache (a size of 0 disables it)
+    size_t _path_cache_size;
+    long _path_cache_valid; // TTL in milliseconds
+    bool _path_cache_inotify; // Also drop entries on inotify events (Linux)
+    // Open file descriptors kept for static files (a max of 0 disables it)
+    size_t _open_file_cache_max;
+    long _open_file_cache_inactive; // Milliseconds unused before an fd is closed
+    long _open_file_cache_valid; // Milliseconds between stat() revalidations
+    // Request head caps: line plus header bytes, and header field count
+    size_t _client_max_header_size;
+    size_t _client_max_headers;
 };
 
 #endif
\ No newline at end of file
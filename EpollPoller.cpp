@@ -0,0 +1,89 @@
+#include "EpollPoller.hpp"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+
+EpollPoller::EpollPoller() : _registered(0), _buffer(64) {
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd < 0) throw std::runtime_error("epoll_create1() failed");
+}
+
+EpollPoller::~EpollPoller() {
+    if (_epfd >= 0) close(_epfd);
+}
+
+const char* EpollPoller::name() const {
+    return "epoll";
+}
+
+unsigned int EpollPoller::_toEpoll(int events) {
+    unsigned int ep = 0;
+    if (events & EVENT_READ) ep |= EPOLLIN;
+    if (events & EVENT_WRITE) ep |= EPOLLOUT;
+    return ep;
+}
+
+bool EpollPoller::add(int fd, int events) {
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = _toEpoll(events);
+    ev.data.fd = fd;
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &ev) < 0) return false;
+    _setInterest(fd, events);
+    ++_registered;
+    return true;
+}
+
+void EpollPoller::modify(int fd, int events) {
+    struct epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = _toEpoll(events);
+    ev.data.fd = fd;
+    if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+        _setInterest(fd, events);
+    }
+}
+
+void EpollPoller::remove(int fd) {
+    if (getInterest(fd) == 0) return;
+    epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+    _setInterest(fd, 0);
+    --_registered;
+}
+
+int EpollPoller::wait(std::vector<Event>& ready, int timeout_ms) {
+    ready.clear();
+    // Grow the kernel buffer with the number of watched fds so a single
+    // wakeup can drain everything that is ready.
+    if (_buffer.size() < _registered && _buffer.size() < 4096) {
+        _buffer.resize(_registered < 4096 ? _registered : 4096);
+    }
+
+    int n = epoll_wait(_epfd, &_buffer[0], static_cast<int>(_buffer.size()), timeout_ms);
+    if (n <= 0) return n;
+
+    for (int i = 0; i < n; ++i) {
+        int fd = _buffer[i].data.fd;
+        int interest = getInterest(fd);
+        int events = 0;
+        if (_buffer[i].events & EPOLLIN) events |= EVENT_READ;
+        if (_buffer[i].events & EPOLLOUT) events |= EVENT_WRITE;
+        if (_buffer[i].events & (EPOLLERR | EPOLLHUP)) {
+            // Let the registered handlers observe the hangup (read() == 0,
+            // write() == EPIPE) instead of inventing a separate error path.
+            // An fd with reads paused still gets its read handler.
+            int watched = interest & (EVENT_READ | EVENT_WRITE);
+            events |= EVENT_ERROR | (watched ? watched : EVENT_READ);
+        }
+        Event ev;
+        ev.fd = fd;
+        ev.events = events;
+        ready.push_back(ev);
+    }
+    return n;
+}
+
+#endif // __linux__
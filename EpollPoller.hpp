@@ -0,0 +1,33 @@
+#ifndef EPOLL_POLLER_HPP
+#define EPOLL_POLLER_HPP
+
+#ifdef __linux__
+
+#include <sys/epoll.h>
+#include "Poller.hpp"
+
+// Level-triggered epoll backend. Each wakeup costs O(ready fds) and there
+// is no FD_SETSIZE cap, so tens of thousands of idle keep-alive
+// connections stay cheap.
+class EpollPoller : public Poller {
+public:
+    EpollPoller();
+    virtual ~EpollPoller();
+
+    virtual const char* name() const;
+    virtual bool add(int fd, int events);
+    virtual void modify(int fd, int events);
+    virtual void remove(int fd);
+    virtual int wait(std::vector<Event>& ready, int timeout_ms);
+
+private:
+    static unsigned int _toEpoll(int events);
+
+    int _epfd;
+    size_t _registered;
+    std::vector<struct epoll_event> _buffer;
+};
+
+#endif // __linux__
+
+#endif // EPOLL_POLLER_HPP
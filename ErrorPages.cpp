@@ -0,0 +1,138 @@
+#include "ErrorPages.hpp"
+#include "ConfigParser.hpp"
+#include "HttpResponse.hpp"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Statuses the server sends itself, built up front along with every code
+// that has an error_page.
+static const int k_default_codes[] = {400, 403, 404, 405, 408, 413, 414, 431, 500, 501, 502, 503, 504, 505};
+
+ErrorPages::ErrorPages(const ConfigParser& config) : _config(config) {
+    build();
+}
+
+ErrorPages::~ErrorPages() {
+    _clear();
+}
+
+const char* ErrorPages::reasonPhrase(int code) {
+    switch (code) {
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 411: return "Length Required";
+        case 413: return "Payload Too Large";
+        case 414: return "URI Too Long";
+        case 415: return "Unsupported Media Type";
+        case 416: return "Range Not Satisfiable";
+        case 417: return "Expectation Failed";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        case 505: return "HTTP Version Not Supported";
+        default: return code < 500 ? "Client Error" : "Server Error";
+    }
+}
+
+void ErrorPages::build() {
+    _clear();
+    const std::vector<LocationConfig*>& locations = _config.getLocations();
+    const std::map<int, std::string>& pages = _config.getErrorPages();
+
+    for (size_t i = 0; i < sizeof(k_default_codes) / sizeof(k_default_codes[0]); ++i) {
+        _reply(NULL, k_default_codes[i]);
+    }
+    for (std::map<int, std::string>::const_iterator it = pages.begin(); it != pages.end(); ++it) {
+        _reply(NULL, it->first);
+    }
+    for (size_t i = 0; i < locations.size(); ++i) {
+        const ReplyTable& server = _tables[NULL];
+        for (ReplyTable::const_iterator it = server.begin(); it != server.end(); ++it) {
+            _reply(locations[i], it->first);
+        }
+        const std::map<int, std::string>& own = locations[i]->error_pages;
+        for (std::map<int, std::string>::const_iterator it = own.begin(); it != own.end(); ++it) {
+            _reply(locations[i], it->first);
+        }
+    }
+}
+
+SharedBuffer* ErrorPages::find(const LocationConfig* loc, int code, bool close) {
+    const Reply& reply = _reply(loc, code);
+    return (close ? reply.close : reply.keep_alive)->retain();
+}
+
+// Looks the reply up, building it on a miss. A location without its own
+// page for `code` shares the server-level buffers.
+const ErrorPages::Reply& ErrorPages::_reply(const LocationConfig* loc, int code) {
+    ReplyTable& table = _tables[loc];
+    ReplyTable::iterator it = table.find(code);
+    if (it != table.end()) return it->second;
+
+    Reply reply;
+    if (loc && !loc->error_pages.count(code)) {
+        const Reply& server = _reply(NULL, code);
+        reply.keep_alive = server.keep_alive->retain();
+        reply.close = server.close->retain();
+    } else {
+        std::string page;
+        if (loc) {
+            page = loc->error_pages.find(code)->second;
+        } else if (_config.getErrorPages().count(code)) {
+            page = _config.getErrorPages().find(code)->second;
+        }
+        reply = _render(code, page);
+    }
+    return table.insert(std::make_pair(code, reply)).first->second;
+}
+
+ErrorPages::Reply ErrorPages::_render(int code, const std::string& page) {
+    std::string body;
+    if (!page.empty()) {
+        std::string full_path = _config.getRoot() + page;
+        std::ifstream file(full_path.c_str(), std::ios::in | std::ios::binary);
+        if (file) {
+            std::stringstream content;
+            content << file.rdbuf();
+            body = content.str();
+        } else {
+            std::cerr << "Warning: Custom error page not found or could not be opened: " << full_path << std::endl;
+        }
+    }
+    if (body.empty()) { // Generic HTML
+        std::stringstream body_ss;
+        body_ss << "<html><body><h1>" << code << " " << reasonPhrase(code) << "</h1></body></html>";
+        body = body_ss.str();
+    }
+
+    HttpResponse res;
+    res.setStatusCode(code, reasonPhrase(code));
+    res.addHeader("Content-Type", "text/html");
+    std::stringstream len_ss;
+    len_ss << body.length();
+    res.addHeader("Content-Length", len_ss.str());
+    res.setBody(body);
+
+    Reply reply;
+    reply.keep_alive = new SharedBuffer(res.toString());
+    res.addHeader("Connection", "close");
+    reply.close = new SharedBuffer(res.toString());
+    return reply;
+}
+
+void ErrorPages::_clear() {
+    for (std::map<const LocationConfig*, ReplyTable>::iterator t = _tables.begin(); t != _tables.end(); ++t) {
+        for (ReplyTable::iterator it = t->second.begin(); it != t->second.end(); ++it) {
+            SharedBuffer::release(it->second.keep_alive);
+            SharedBuffer::release(it->second.close);
+        }
+    }
+    _tables.clear();
+}
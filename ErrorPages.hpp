@@ -0,0 +1,48 @@
+#ifndef ERROR_PAGES_HPP
+#define ERROR_PAGES_HPP
+
+#include <map>
+#include <string>
+#include "SharedBuffer.hpp"
+
+class ConfigParser;
+struct LocationConfig;
+
+// Complete wire bytes of every error reply, per location and status: the
+// custom error_page (location first, then server) or the generic body,
+// serialized once with and once without "Connection: close". Replies are
+// handed out as shared buffers; rebuilding releases the old set, and
+// connections still sending one keep it alive until they are done.
+class ErrorPages {
+public:
+    explicit ErrorPages(const ConfigParser& config);
+    ~ErrorPages();
+
+    // (Re)reads the error pages from disk and rebuilds every reply.
+    void build();
+    // The reply for `code` at `loc` (NULL when no location matched), with a
+    // reference for the caller. Statuses not built up front are added on
+    // first use.
+    SharedBuffer* find(const LocationConfig* loc, int code, bool close);
+
+    static const char* reasonPhrase(int code);
+
+private:
+    struct Reply {
+        SharedBuffer* keep_alive;
+        SharedBuffer* close;
+    };
+    typedef std::map<int, Reply> ReplyTable;
+
+    ErrorPages(const ErrorPages&);
+    ErrorPages& operator=(const ErrorPages&);
+
+    const Reply& _reply(const LocationConfig* loc, int code);
+    Reply _render(int code, const std::string& page);
+    void _clear();
+
+    const ConfigParser& _config;
+    std::map<const LocationConfig*, ReplyTable> _tables;
+};
+
+#endif // ERROR_PAGES_HPP
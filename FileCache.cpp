@@ -0,0 +1,105 @@
+#include "FileCache.hpp"
+#include "TimerWheel.hpp"
+
+FileCache::FileCache(size_t max_bytes, size_t max_file_size, unsigned long valid_ms) :
+    _max_bytes(max_bytes),
+    _max_file_size(max_file_size),
+    _valid_ms(valid_ms),
+    _bytes(0),
+    _hits(0),
+    _misses(0),
+    _evictions(0)
+{}
+
+FileCache::~FileCache() {}
+
+bool FileCache::isEnabled() const {
+    return _max_bytes > 0;
+}
+
+bool FileCache::fits(off_t size) const {
+    return isEnabled() && size >= 0 && static_cast<size_t>(size) <= _max_file_size
+        && static_cast<size_t>(size) <= _max_bytes;
+}
+
+size_t FileCache::_cost(const Entry& entry) {
+    return entry.path.size() + entry.headers.size() + entry.body.size() + entry.source.size();
+}
+
+const FileCache::Entry* FileCache::lookup(const std::string& path) {
+    if (!isEnabled()) return NULL;
+
+    EntryIndex::iterator it = _index.find(path);
+    if (it == _index.end()) {
+        ++_misses;
+        return NULL;
+    }
+
+    Entry& entry = *it->second;
+    unsigned long now = TimerWheel::nowMs();
+    if (now - entry.validated_ms >= _valid_ms) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || st.st_ino != entry.ino || st.st_dev != entry.dev
+            || st.st_size != entry.size || st.st_mtime != entry.mtime
+            || (!entry.source.empty() && (stat(entry.source.c_str(), &st) != 0 || st.st_mtime > entry.mtime))) {
+            _erase(it);
+            ++_misses;
+            return NULL;
+        }
+        entry.validated_ms = now;
+    }
+
+    _lru.splice(_lru.begin(), _lru, it->second);
+    ++_hits;
+    return &*it->second;
+}
+
+const FileCache::Entry* FileCache::store(const std::string& path, const struct stat& st,
+                                         const std::string& headers, const std::string& body,
+                                         const std::string& source) {
+    if (!fits(st.st_size)) return NULL;
+
+    EntryIndex::iterator existing = _index.find(path);
+    if (existing != _index.end()) _erase(existing);
+
+    Entry entry;
+    entry.path = path;
+    entry.headers = headers;
+    entry.body = body;
+    entry.dev = st.st_dev;
+    entry.ino = st.st_ino;
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    entry.source = source;
+    entry.validated_ms = TimerWheel::nowMs();
+
+    size_t cost = _cost(entry);
+    if (cost > _max_bytes) return NULL;
+    while (_bytes + cost > _max_bytes && !_lru.empty()) {
+        _erase(_index.find(_lru.back().path));
+        ++_evictions;
+    }
+
+    _lru.push_front(entry);
+    _index[path] = _lru.begin();
+    _bytes += cost;
+    return &_lru.front();
+}
+
+void FileCache::_erase(EntryIndex::iterator it) {
+    _bytes -= _cost(*it->second);
+    _lru.erase(it->second);
+    _index.erase(it);
+}
+
+void FileCache::clear() {
+    _lru.clear();
+    _index.clear();
+    _bytes = 0;
+}
+
+unsigned long FileCache::getHits() const { return _hits; }
+unsigned long FileCache::getMisses() const { return _misses; }
+unsigned long FileCache::getEvictions() const { return _evictions; }
+size_t FileCache::getEntryCount() const { return _index.size(); }
+size_t FileCache::getBytes() const { return _bytes; }
@@ -0,0 +1,72 @@
+#ifndef FILE_CACHE_HPP
+#define FILE_CACHE_HPP
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctime>
+#include <list>
+#include <map>
+#include <string>
+
+// Byte-budgeted LRU of small static files, keyed by resolved path. Each
+// entry keeps the serialized 200 header block next to the body, so a hit
+// is served without touching the filesystem. Entries are revalidated
+// against inode/size/mtime at most once every `valid_ms`.
+class FileCache {
+public:
+    struct Entry {
+        std::string path;
+        std::string headers; // Serialized status line and headers
+        std::string body;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        time_t mtime;
+        // For a precompressed sidecar, the file it was built from: the entry
+        // is dropped once the source is newer than the sidecar.
+        std::string source;
+        unsigned long validated_ms;
+    };
+
+    FileCache(size_t max_bytes, size_t max_file_size, unsigned long valid_ms);
+    ~FileCache();
+
+    bool isEnabled() const;
+    // Files bigger than this are streamed with sendfile() instead.
+    bool fits(off_t size) const;
+    // Returns the entry for `path` or NULL on a miss. A stale entry (the
+    // file changed or vanished) is dropped and reported as a miss.
+    const Entry* lookup(const std::string& path);
+    const Entry* store(const std::string& path, const struct stat& st,
+                       const std::string& headers, const std::string& body,
+                       const std::string& source = "");
+    void clear();
+
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+    unsigned long getEvictions() const;
+    size_t getEntryCount() const;
+    size_t getBytes() const;
+
+private:
+    typedef std::list<Entry> EntryList;
+    typedef std::map<std::string, EntryList::iterator> EntryIndex;
+
+    FileCache(const FileCache&);
+    FileCache& operator=(const FileCache&);
+
+    void _erase(EntryIndex::iterator it);
+    static size_t _cost(const Entry& entry);
+
+    size_t _max_bytes;
+    size_t _max_file_size;
+    unsigned long _valid_ms;
+    size_t _bytes;
+    EntryList _lru; // Most recently used first
+    EntryIndex _index;
+    unsigned long _hits;
+    unsigned long _misses;
+    unsigned long _evictions;
+};
+
+#endif // FILE_CACHE_HPP
@@ -1,5 +1,6 @@
 #include "HttpRequest.hpp"
 #include <sstream>
+#include <cctype>
 #include <vector>
 #include <iostream> // Added for debug output
 
@@ -7,6 +8,7 @@ HttpRequest::HttpRequest() :
     _method(""),
     _uri(""),
     _version(""),
+    _allHeaders(false),
     _body(""),
     _queryString("") // Initialize _queryString
 {
@@ -27,21 +29,61 @@ void HttpRequest::setUri(const std::string& uri) {
     }
 }
 void HttpRequest::setVersion(const std::string& version) { _version = version; }
-void HttpRequest::addHeader(const std::string& name, const std::string& value) { _headers[name] = value; }
+// Headers added after the head (chunked trailers) go to the end of the head
+// buffer like the others.
+void HttpRequest::addHeader(const std::string& name, const std::string& value) {
+    size_t name_off = _head.size();
+    _head += name;
+    size_t value_off = _head.size();
+    _head += value;
+    addHeaderSlice(name_off, name.size(), value_off, value.size());
+}
+
+std::string& HttpRequest::headBuffer() { return _head; }
+
+void HttpRequest::addHeaderSlice(size_t name, size_t name_len, size_t value, size_t value_len) {
+    HeaderSlice slice;
+    slice.name = name;
+    slice.name_len = name_len;
+    slice.value = value;
+    slice.value_len = value_len;
+    _slices.push_back(slice);
+    _headers.clear(); // A repeated header may now win over a cached value
+    _allHeaders = false;
+}
 void HttpRequest::setBody(const std::string& body) { _body = body; }
 void HttpRequest::appendBody(const std::string& data) { _body.append(data); }
+void HttpRequest::appendBody(const char* data, size_t len) { _body.append(data, len); }
 
 const std::string& HttpRequest::getMethod() const { return _method; }
 const std::string& HttpRequest::getUri() const { return _uri; }
 const std::string& HttpRequest::getVersion() const { return _version; }
 const std::string HttpRequest::getQueryString() const { return _queryString; } // Return by value as it's a copy
-const std::map<std::string, std::string>& HttpRequest::getHeaders() const { return _headers; }
+const std::map<std::string, std::string>& HttpRequest::getHeaders() const {
+    if (!_allHeaders) {
+        for (size_t i = 0; i < _slices.size(); ++i) getHeader(_head.substr(_slices[i].name, _slices[i].name_len));
+        _allHeaders = true;
+    }
+    return _headers;
+}
 
+// Field names are case-insensitive; the last occurrence of a repeated field
+// wins. The value is copied out of the head once and cached.
 const std::string& HttpRequest::getHeader(const std::string& name) const {
     std::map<std::string, std::string>::const_iterator it = _headers.find(name);
     if (it != _headers.end()) {
         return it->second;
     }
+    for (size_t i = _slices.size(); i-- > 0; ) {
+        const HeaderSlice& slice = _slices[i];
+        if (slice.name_len != name.size()) continue;
+        size_t j = 0;
+        while (j < name.size() && std::tolower(static_cast<unsigned char>(_head[slice.name + j]))
+                                      == std::tolower(static_cast<unsigned char>(name[j]))) ++j;
+        if (j == name.size()) {
+            return _headers[name] = _head.substr(slice.value, slice.value_len);
+        }
+    }
     // Return a reference to an empty string if header not found
     static const std::string empty_string = "";
     return empty_string;
@@ -54,6 +96,16 @@ void HttpRequest::addUploadedFile(const std::string& fieldName, const std::strin
     file.fieldName = fieldName;
     file.filename = filename;
     file.content = content;
+    file.failed = false;
+    _uploadedFiles.push_back(file);
+}
+
+void HttpRequest::addStoredFile(const std::string& fieldName, const std::string& filename, const std::string& path, bool failed) {
+    UploadedFile file;
+    file.fieldName = fieldName;
+    file.filename = filename;
+    file.path = path;
+    file.failed = failed;
     _uploadedFiles.push_back(file);
 }
 
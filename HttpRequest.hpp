@@ -19,29 +19,48 @@ public:
     void setVersion(const std::string& version); // Added
     const std::map<std::string, std::string>& getHeaders() const;
     void addHeader(const std::string& name, const std::string& value); // Added
+    // The raw request head. The parser appends to it and records each header
+    // as offsets into it; a header becomes a string only when looked up.
+    std::string& headBuffer();
+    void addHeaderSlice(size_t name, size_t name_len, size_t value, size_t value_len);
     struct UploadedFile {
         std::string fieldName;
         std::string filename;
-        std::string content;
+        std::string content; // Kept in memory when there is no upload directory
+        std::string path;    // Where the part was streamed to, otherwise
+        bool failed;         // Streaming or the final rename failed
     };
 
     const std::string& getHeader(const std::string& name) const; // Corrected return type
     const std::string& getBody() const;
     void setBody(const std::string& body); // Added
     void appendBody(const std::string& data);
+    void appendBody(const char* data, size_t len);
 
     // New methods for multipart parsing
     void addUploadedFile(const std::string& fieldName, const std::string& filename, const std::string& content);
+    void addStoredFile(const std::string& fieldName, const std::string& filename, const std::string& path, bool failed);
     void addFormField(const std::string& fieldName, const std::string& value);
     const std::vector<UploadedFile>& getUploadedFiles() const;
     const std::map<std::string, std::string>& getFormFields() const;
 
 
 private:
+    struct HeaderSlice {
+        size_t name;
+        size_t name_len;
+        size_t value;
+        size_t value_len;
+    };
+
     std::string _method;
     std::string _uri;
     std::string _version;
-    std::map<std::string, std::string> _headers;
+    std::string _head;
+    std::vector<HeaderSlice> _slices;
+    // Headers turned into strings so far, by the name they were asked for
+    mutable std::map<std::string, std::string> _headers;
+    mutable bool _allHeaders; // getHeaders() materialized every slice
     std::string _body;
     std::string _queryString;
 
@@ -1,95 +1,158 @@
 #include "HttpRequestParser.hpp"
+#include "ByteScan.hpp"
 #include <sstream>
 #include <iostream> // For debug
+#include <cstdlib> // For strtol
+#include <cstdio> // For fflush
+#include <cstring> // For memcmp
+#include <algorithm> // For std::min
+#include <cerrno>
+#include <fcntl.h> // For fcntl
+#include <unistd.h> // For write, close, unlink
+#include <sys/stat.h> // For fchmod
+
+// Bytes of a file part gathered before each write() to its temp file.
+static const size_t k_upload_buffer = 64 * 1024;
+// Longest chunk-size or trailer line accepted.
+static const size_t k_max_chunk_line = 1024;
+
+size_t HttpRequestParser::_maxHeadSize = 16 * 1024;
+size_t HttpRequestParser::_maxHeaderCount = 100;
 
 HttpRequestParser::HttpRequestParser() :
     _state(PARSING_REQUEST_LINE),
+    _lineStart(0),
     _contentLength(0),
     _bodyBytesRead(0),
+    _bodyLimit(static_cast<size_t>(-1)),
+    _headerCount(0),
+    _errorStatus(0),
     _chunkState(CHUNK_SIZE),
     _currentChunkSize(0),
     _bytesReadInChunk(0),
     _isParsingFile(false), // Initialize new members
-    _multipartState(MULTIPART_START) // Initialize new members
+    _multipartState(MULTIPART_START), // Initialize new members
+    _uploadFd(-1),
+    _uploadFailed(false),
+    _uploadBuffered(0),
+    _streamedBytes(0)
 {
     _multipartBuffer.clear();
 }
 
-HttpRequestParser::~HttpRequestParser() {}
+// A part still being received when the request is dropped leaves nothing
+// behind in the upload directory.
+HttpRequestParser::~HttpRequestParser() {
+    if (_uploadFd >= 0) {
+        close(_uploadFd);
+        unlink(_uploadTemp.c_str());
+    }
+}
+
+void HttpRequestParser::skipBody() {
+    _state = PARSING_COMPLETE;
+}
+
+void HttpRequestParser::setHeadLimits(size_t max_size, size_t max_fields) {
+    _maxHeadSize = max_size;
+    _maxHeaderCount = max_fields;
+}
 
-HttpRequestParser::ParsingState HttpRequestParser::parse(std::string& data) {
+void HttpRequestParser::setBodyLimit(size_t limit) {
+    _bodyLimit = limit;
+}
+
+int HttpRequestParser::getErrorStatus() const {
+    return _errorStatus;
+}
+
+void HttpRequestParser::fail(int status) {
+    _state = PARSING_ERROR;
+    _errorStatus = status;
+}
+
+void HttpRequestParser::setUploadDir(const std::string& dir) {
+    if (_multipartState == MULTIPART_START) {
+        _uploadDir = dir;
+    }
+}
+
+size_t HttpRequestParser::parse(const char* data, size_t len) {
+    size_t pos = 0;
     while (_state != PARSING_COMPLETE && _state != PARSING_ERROR) {
-        if (_state == PARSING_REQUEST_LINE) {
-            size_t crlf_pos = data.find("\r\n");
-            if (crlf_pos == std::string::npos) {
-                break; // Not enough data for request line
+        if (_state == PARSING_REQUEST_LINE || _state == PARSING_HEADERS) {
+            size_t line, line_len;
+            if (!takeHeadLine(data, len, pos, line, line_len)) {
+                break; // Not enough data for a full line
             }
-            parseRequestLine(data.substr(0, crlf_pos));
-            data.erase(0, crlf_pos + 2);
-            _state = PARSING_HEADERS;
-        } else if (_state == PARSING_HEADERS) {
-            size_t crlf_pos = data.find("\r\n");
-            if (crlf_pos == std::string::npos) {
-                break; // Not enough data for a header line
-            }
-            std::string line = data.substr(0, crlf_pos);
-            data.erase(0, crlf_pos + 2);
-
-            if (line.empty()) { // End of headers
-                std::string content_type = _request.getHeader("Content-Type");
-                if (content_type.find("multipart/form-data") != std::string::npos) {
-                    size_t boundary_pos = content_type.find("boundary=");
-                    if (boundary_pos != std::string::npos) {
-                        _multipartBoundary = "--" + content_type.substr(boundary_pos + 9);
-                        std::cerr << "DEBUG: Extracted boundary: '" << _multipartBoundary << "', length: " << _multipartBoundary.length() << std::endl;
-                        _state = PARSING_MULTIPART_BODY;
-                        _multipartState = MULTIPART_START;
-                    } else {
-                        _state = PARSING_ERROR; // Malformed multipart header
-                    }
-                } else {
-                    // Check for Transfer-Encoding: chunked
-                    std::string transfer_encoding = _request.getHeader("Transfer-Encoding");
-                    if (transfer_encoding == "chunked") {
-                        _state = PARSING_CHUNKED_BODY;
-                    } else {
-                        // Get Content-Length for non-chunked body
-                        std::string cl_str = _request.getHeader("Content-Length");
-                        if (!cl_str.empty()) {
-                            _contentLength = std::strtol(cl_str.c_str(), NULL, 10);
-                        } else {
-                            _contentLength = 0;
-                        }
-                        _state = PARSING_BODY;
-                    }
+            if (_state == PARSING_REQUEST_LINE) {
+                if (line_len == 0) continue; // Stray CRLF before a request (RFC 9112, 2.2)
+                parseRequestLine(line, line_len);
+                _state = PARSING_HEADERS;
+            } else if (line_len == 0) { // End of headers
+                endOfHeaders();
+                if (_state != PARSING_COMPLETE) {
+                    break; // Let the caller route the body first
                 }
             } else {
-                parseHeader(line);
+                parseHeader(line, line_len);
             }
         } else if (_state == PARSING_BODY) {
-            parseBody(data); // Pass data to parseBody
+            pos += parseBody(data + pos, len - pos);
             if (_bodyBytesRead >= _contentLength) {
                 _state = PARSING_COMPLETE;
             } else {
                 break; // Not enough body data yet
             }
         } else if (_state == PARSING_CHUNKED_BODY) {
-            parseChunkedBody(data); // Pass data to parseChunkedBody
+            pos += parseChunkedBody(data + pos, len - pos);
             if (_chunkState == CHUNK_COMPLETE) {
                 _state = PARSING_COMPLETE;
-            } else {
+            } else if (_state != PARSING_ERROR) {
                 break; // Not enough chunked data yet
             }
         } else if (_state == PARSING_MULTIPART_BODY) {
-            parseMultipartBody(data);
-            if (_multipartState == MULTIPART_END) { // Assuming MULTIPART_END means complete
+            // Bytes past Content-Length belong to the next pipelined request
+            size_t avail = len - pos;
+            if (_contentLength > 0) avail = std::min(avail, _contentLength - _bodyBytesRead);
+            size_t used = parseMultipartBody(data + pos, avail);
+            _bodyBytesRead += used;
+            pos += used;
+            if (_bodyBytesRead > _bodyLimit) {
+                fail(413);
+            } else if (_multipartState == MULTIPART_END && _bodyBytesRead >= _contentLength) {
                 _state = PARSING_COMPLETE;
-            } else {
+            } else if (_contentLength > 0 && _bodyBytesRead >= _contentLength) {
+                fail(400); // Declared length used up before the closing boundary
+            } else if (_state != PARSING_ERROR) {
                 break; // Not enough multipart data yet
             }
         }
     }
-    return _state;
+    return pos;
+}
+
+// Copies bytes up to and including the next LF into the head buffer. When
+// the line is complete, returns true with its offset and length in the head
+// (without CRLF); otherwise everything available was taken and the line
+// continues with the next read.
+bool HttpRequestParser::takeHeadLine(const char* data, size_t len, size_t& pos, size_t& line, size_t& line_len) {
+    std::string& head = _request.headBuffer();
+    const char* lf = ByteScan::find(data + pos, data + len, '\n');
+    size_t take = lf ? static_cast<size_t>(lf - (data + pos)) + 1 : len - pos;
+    head.append(data + pos, take);
+    pos += take;
+    if (head.size() > _maxHeadSize) {
+        fail(_state == PARSING_REQUEST_LINE ? 414 : 431);
+        return false;
+    }
+    if (!lf) return false;
+
+    line = _lineStart;
+    line_len = head.size() - 1 - _lineStart;
+    if (line_len > 0 && head[line + line_len - 1] == '\r') --line_len;
+    _lineStart = head.size();
+    return true;
 }
 
 const HttpRequest& HttpRequestParser::getRequest() const {
@@ -100,71 +163,137 @@ HttpRequestParser::ParsingState HttpRequestParser::getState() const {
     return _state;
 }
 
-void HttpRequestParser::parseRequestLine(const std::string& line) {
-    std::stringstream ss(line);
-    std::string method, uri, version;
-    ss >> method >> uri >> version;
-    _request.setMethod(method); // Need setters in HttpRequest
-    _request.setUri(uri);       // Need setters in HttpRequest
-    _request.setVersion(version); // Need setters in HttpRequest
+size_t HttpRequestParser::getBodySize() const {
+    return std::max(_bodyBytesRead, _request.getBody().length());
 }
 
-void HttpRequestParser::parseHeader(const std::string& line) {
-    size_t colon_pos = line.find(':');
-    if (colon_pos != std::string::npos) {
-        std::string key = line.substr(0, colon_pos);
-        std::string value = line.substr(colon_pos + 1);
+size_t HttpRequestParser::getStreamedBytes() const {
+    return _streamedBytes;
+}
 
-        size_t first_char = value.find_first_not_of(" \t");
-        if (first_char != std::string::npos) {
-            value = value.substr(first_char);
+// Whitespace-separated method, URI and version, taken straight from the head.
+void HttpRequestParser::parseRequestLine(size_t line, size_t len) {
+    const char* head = _request.headBuffer().data();
+    std::string fields[3];
+    const char* pos = head + line;
+    const char* end = pos + len;
+    for (int i = 0; i < 3; ++i) {
+        while (pos < end && (*pos == ' ' || *pos == '\t')) ++pos;
+        const char* start = pos;
+        pos = ByteScan::findEither(pos, end, ' ', '\t');
+        if (!pos) pos = end;
+        fields[i].assign(start, pos - start);
+    }
+    _request.setMethod(fields[0]); // Need setters in HttpRequest
+    _request.setUri(fields[1]);       // Need setters in HttpRequest
+    _request.setVersion(fields[2]); // Need setters in HttpRequest
+}
+
+// Records "Name: value" as offsets into the head, value trimmed of blanks.
+void HttpRequestParser::parseHeader(size_t line, size_t len) {
+    const std::string& head = _request.headBuffer();
+    const char* start = head.data() + line;
+    const char* colon = ByteScan::find(start, start + len, ':');
+    if (!colon) return;
+    if (++_headerCount > _maxHeaderCount) {
+        fail(431);
+        return;
+    }
+    size_t name_len = colon - start;
+    size_t value = line + name_len + 1, end = line + len;
+    while (value < end && (head[value] == ' ' || head[value] == '\t')) ++value;
+    while (end > value && (head[end - 1] == ' ' || head[end - 1] == '\t')) --end;
+    _request.addHeaderSlice(line, name_len, value, end - value);
+}
+
+void HttpRequestParser::endOfHeaders() {
+    const std::string& content_type = _request.getHeader("Content-Type");
+    const std::string& cl_str = _request.getHeader("Content-Length");
+    if (!cl_str.empty()) {
+        char* end;
+        _contentLength = std::strtoul(cl_str.c_str(), &end, 10);
+        if (cl_str[0] < '0' || cl_str[0] > '9' || *end != '\0') {
+            fail(400); // Signed, empty or trailing garbage
+            return;
         }
-        size_t last_char = value.find_last_not_of(" \t\r\n");
-        if (last_char != std::string::npos) {
-            value = value.substr(0, last_char + 1);
+    }
+    if (content_type.find("multipart/form-data") != std::string::npos) {
+        size_t boundary_pos = content_type.find("boundary=");
+        if (boundary_pos != std::string::npos) {
+            _multipartBoundary = "--" + content_type.substr(boundary_pos + 9);
+            _state = PARSING_MULTIPART_BODY;
+            _multipartState = MULTIPART_START;
+            _multipartBuffer = "\r\n"; // So the opening boundary matches the delimiter
+            buildDelimiterSkip();
+        } else {
+            fail(400); // Malformed multipart header
         }
-        _request.addHeader(key, value); // Need addHeader in HttpRequest
+    } else if (_request.getHeader("Transfer-Encoding") == "chunked") {
+        _state = PARSING_CHUNKED_BODY;
+    } else {
+        _state = _contentLength > 0 ? PARSING_BODY : PARSING_COMPLETE;
     }
 }
 
-void HttpRequestParser::parseBody(std::string& data) {
-    size_t to_read = std::min(_contentLength - _bodyBytesRead, data.length());
-    _request.appendBody(data.substr(0, to_read));
-    data.erase(0, to_read);
+size_t HttpRequestParser::parseBody(const char* data, size_t len) {
+    size_t to_read = std::min(_contentLength - _bodyBytesRead, len);
+    _request.appendBody(data, to_read);
     _bodyBytesRead += to_read;
+    return to_read;
 }
 
-void HttpRequestParser::parseChunkedBody(std::string& data) {
+size_t HttpRequestParser::parseChunkedBody(const char* data, size_t len) {
+    size_t pos = 0;
     while (_chunkState != CHUNK_COMPLETE && _state != PARSING_ERROR) {
-        if (_chunkState == CHUNK_SIZE) {
-            size_t crlf_pos = data.find("\r\n");
-            if (crlf_pos == std::string::npos) {
-                break; // Not enough data for chunk size line
+        if (_chunkState == CHUNK_SIZE || _chunkState == CHUNK_TRAILER_CRLF) {
+            const char* lf = ByteScan::find(data + pos, data + len, '\n');
+            if (!lf) {
+                _chunkLine.append(data + pos, len - pos);
+                pos = len;
+                if (_chunkLine.length() > k_max_chunk_line) fail(400);
+                break; // Not enough data for the line
             }
-            std::string size_str = data.substr(0, crlf_pos);
-            
-            // Error checking for strtol
-            char *endptr;
-            _currentChunkSize = std::strtol(size_str.c_str(), &endptr, 16);
-            if (endptr == size_str.c_str() || (*endptr != '\0' && *endptr != ';')) { // Invalid hex char or extra chars before semicolon
-                _state = PARSING_ERROR; // Malformed chunk size
-                return;
+            _chunkLine.append(data + pos, lf - (data + pos));
+            pos = lf - data + 1;
+            if (!_chunkLine.empty() && _chunkLine[_chunkLine.length() - 1] == '\r') {
+                _chunkLine.erase(_chunkLine.length() - 1);
             }
 
-            data.erase(0, crlf_pos + 2); // Consume chunk size line
-
-            if (_currentChunkSize == 0) {
-                _chunkState = CHUNK_TRAILER_CRLF; // Expecting 0\r\n then optional trailers
-            } else {
-                _chunkState = CHUNK_DATA;
-                _bytesReadInChunk = 0;
+            if (_chunkState == CHUNK_SIZE) {
+                // Error checking for strtol
+                char *endptr;
+                _currentChunkSize = std::strtol(_chunkLine.c_str(), &endptr, 16);
+                if (endptr == _chunkLine.c_str() || (*endptr != '\0' && *endptr != ';')) { // Invalid hex char or extra chars before semicolon
+                    fail(400); // Malformed chunk size
+                    return pos;
+                }
+                size_t received = _request.getBody().length();
+                if (_currentChunkSize > _bodyLimit - std::min(received, _bodyLimit)) {
+                    fail(413); // Refused before its data is read
+                    return pos;
+                }
+                if (_currentChunkSize == 0) {
+                    _chunkState = CHUNK_TRAILER_CRLF; // Expecting 0\r\n then optional trailers
+                } else {
+                    _chunkState = CHUNK_DATA;
+                    _bytesReadInChunk = 0;
+                }
+            } else if (_chunkLine.empty()) { // Final \r\n, end of chunked body
+                _chunkState = CHUNK_COMPLETE;
+            } else { // Trailing header
+                size_t colon = _chunkLine.find(':');
+                if (colon != std::string::npos) {
+                    size_t value = _chunkLine.find_first_not_of(" \t", colon + 1);
+                    _request.addHeader(_chunkLine.substr(0, colon),
+                                       value == std::string::npos ? "" : _chunkLine.substr(value));
+                }
+                // Stay in CHUNK_TRAILER_CRLF to process more trailers or final CRLF
             }
+            _chunkLine.clear();
         } else if (_chunkState == CHUNK_DATA) {
-            size_t remaining_in_chunk = _currentChunkSize - _bytesReadInChunk;
-            size_t to_read = std::min(remaining_in_chunk, data.length());
-
-            _request.appendBody(data.substr(0, to_read));
-            data.erase(0, to_read);
+            size_t to_read = std::min(_currentChunkSize - _bytesReadInChunk, len - pos);
+            _request.appendBody(data + pos, to_read);
+            pos += to_read;
             _bytesReadInChunk += to_read;
 
             if (_bytesReadInChunk == _currentChunkSize) {
@@ -173,185 +302,262 @@ void HttpRequestParser::parseChunkedBody(std::string& data) {
                 break; // Not enough chunk data yet
             }
         } else if (_chunkState == CHUNK_END_CRLF) {
-            if (data.length() < 2) {
-                break; // Not enough data for CRLF
-            }
-            if (data.substr(0, 2) != "\r\n") {
-                _state = PARSING_ERROR; // Malformed chunk (missing CRLF)
-                return;
-            }
-            data.erase(0, 2); // Consume CRLF
-            _chunkState = CHUNK_SIZE; // Ready for next chunk size
-        } else if (_chunkState == CHUNK_TRAILER_CRLF) {
-            // After 0\r\n, we expect optional trailing headers followed by a final \r\n
-            size_t crlf_pos = data.find("\r\n");
-            if (crlf_pos == std::string::npos) {
-                break; // Not enough data for trailer line or final CRLF
-            }
-            std::string line = data.substr(0, crlf_pos);
-            data.erase(0, crlf_pos + 2);
-
-            if (line.empty()) { // Final \r\n, end of chunked body
-                _chunkState = CHUNK_COMPLETE;
-            } else { // Trailing header
-                parseHeader(line); // Reuse parseHeader for trailing headers
-                // Stay in CHUNK_TRAILER_CRLF to process more trailers or final CRLF
+            // CR then LF, possibly split across reads; _chunkLine holds the CR.
+            if (pos == len) break;
+            char c = data[pos++];
+            if (c == '\r' && _chunkLine.empty()) {
+                _chunkLine = "\r";
+            } else if (c == '\n' && _chunkLine == "\r") {
+                _chunkLine.clear();
+                _chunkState = CHUNK_SIZE; // Ready for next chunk size
+            } else {
+                fail(400); // Malformed chunk (missing CRLF)
+                return pos;
             }
         }
     }
+    return pos;
 }
 
-void HttpRequestParser::parseMultipartBody(std::string& data) {
-    _multipartBuffer.append(data);
-    data.clear();
-
-    std::cerr << "DEBUG: Entering parseMultipartBody. Multipart buffer length: " << _multipartBuffer.length() << std::endl; fflush(stderr);
-    std::cerr << "DEBUG: Multipart boundary: '" << _multipartBoundary << "'" << std::endl; fflush(stderr);
-    std::cerr << "DEBUG: Current multipart state: " << _multipartState << std::endl; fflush(stderr);
-
-    while (_multipartState != MULTIPART_END && _state != PARSING_ERROR) {
-        if (_multipartState == MULTIPART_START) {
-            size_t boundary_pos = _multipartBuffer.find(_multipartBoundary);
-            if (boundary_pos == 0) {
-                _multipartBuffer.erase(0, _multipartBoundary.length());
-                if (_multipartBuffer.length() >= 2 && _multipartBuffer.substr(0, 2) == "\r\n") {
-                    _multipartBuffer.erase(0, 2);
-                }
-                _multipartState = MULTIPART_HEADERS;
-                std::cerr << "DEBUG: Found initial boundary. Transitioning to MULTIPART_HEADERS." << std::endl; fflush(stderr);
-            } else if (boundary_pos == std::string::npos) {
-                std::cerr << "DEBUG: Initial boundary not found in buffer. Waiting for more data." << std::endl; fflush(stderr);
-                break;
-            } else {
-                _state = PARSING_ERROR;
-                std::cerr << "DEBUG: Initial boundary found but not at start. Setting PARSING_ERROR." << std::endl; fflush(stderr);
-                return;
-            }
-        } else if (_multipartState == MULTIPART_HEADERS) {
-            size_t crlf_pos = _multipartBuffer.find("\r\n\r\n");
-            if (crlf_pos == std::string::npos) {
-                std::cerr << "DEBUG: Not enough data for multipart headers. Breaking." << std::endl; fflush(stderr);
-                break;
-            }
-            std::string headers_str = _multipartBuffer.substr(0, crlf_pos);
-            _multipartBuffer.erase(0, crlf_pos + 4);
+static const std::string k_part_head_end = "\r\n\r\n";
 
-            _currentPartHeaders = headers_str;
-            std::cerr << "DEBUG: Parsed multipart headers: \n" << _currentPartHeaders << std::endl; fflush(stderr);
+// Horspool shift table for the body delimiter "\r\n--boundary": how far a
+// window may slide when its last byte is `c`. Shifts are capped at 255,
+// which only shortens the jump for very long boundaries.
+void HttpRequestParser::buildDelimiterSkip() {
+    _delimiter = "\r\n" + _multipartBoundary;
+    size_t n = _delimiter.length();
+    for (int c = 0; c < 256; ++c) _delimiterSkip[c] = static_cast<unsigned char>(std::min<size_t>(n, 255));
+    for (size_t i = 0; i + 1 < n; ++i) {
+        _delimiterSkip[static_cast<unsigned char>(_delimiter[i])] = static_cast<unsigned char>(std::min<size_t>(n - 1 - i, 255));
+    }
+}
 
-            std::stringstream ss_headers(headers_str);
-            std::string line;
-            _isParsingFile = false;
-            _currentFileName = "";
-            _currentFieldName = "";
+// First delimiter in [p, end), or NULL.
+const char* HttpRequestParser::findDelimiter(const char* p, const char* end) const {
+    size_t n = _delimiter.length();
+    const char* delim = _delimiter.data();
+    unsigned char last = static_cast<unsigned char>(delim[n - 1]);
+    while (static_cast<size_t>(end - p) >= n) {
+        unsigned char c = static_cast<unsigned char>(p[n - 1]);
+        if (c == last && std::memcmp(p, delim, n - 1) == 0) return p;
+        p += _delimiterSkip[c];
+    }
+    return NULL;
+}
 
-            while (std::getline(ss_headers, line)) {
-                if (!line.empty() && line[line.length() - 1] == '\r') {
-                    line.erase(line.length() - 1);
-                }
-                if (line.empty()) {
-                    continue;
-                }
-                
-                size_t colon_pos = line.find(":");
-                if (colon_pos != std::string::npos) {
-                    std::string key = line.substr(0, colon_pos);
-                    std::string value = line.substr(colon_pos + 1);
-                    size_t first_char = value.find_first_not_of(" \t");
-                    if (first_char != std::string::npos) {
-                        value = value.substr(first_char);
-                    }
+void HttpRequestParser::appendPartData(const char* data, size_t len) {
+    if (_uploadFd < 0) {
+        if (_uploadFailed) _streamedBytes += len;
+        else _currentPartBody.append(data, len);
+        return;
+    }
+    _streamedBytes += len;
+    if (_uploadBuffered + len > _uploadBuffer.size()) {
+        flushPartFile();
+    }
+    if (len >= _uploadBuffer.size()) {
+        writePartFile(data, len); // Larger than the buffer: skip the copy
+        return;
+    }
+    std::memcpy(&_uploadBuffer[_uploadBuffered], data, len);
+    _uploadBuffered += len;
+}
 
-                    if (key == "Content-Disposition") {
-                        size_t filename_pos = value.find("filename=\"");
-                        if (filename_pos != std::string::npos) {
-                            _isParsingFile = true;
-                            size_t filename_start = filename_pos + 10;
-                            size_t filename_end = value.find("\"", filename_start);
-                            if (filename_end != std::string::npos) {
-                                _currentFileName = value.substr(filename_start, filename_end - filename_start);
-                            }
-                        }
-                        size_t name_pos = value.find("name=\"");
-                        if (name_pos != std::string::npos) {
-                            size_t name_start = name_pos + 6;
-                            size_t name_end = value.find("\"", name_start);
-                            if (name_end != std::string::npos) {
-                                _currentFieldName = value.substr(name_start, name_end - name_start);
-                            }
-                        }
-                    }
-                }
-            }
-            std::cerr << "DEBUG: isParsingFile: " << _isParsingFile << ", FileName: '" << _currentFileName << "', FieldName: '" << _currentFieldName << "'" << std::endl; fflush(stderr);
-            _multipartState = MULTIPART_BODY;
-        } else if (_multipartState == MULTIPART_BODY) {
-            size_t boundary_pos = _multipartBuffer.find(_multipartBoundary);
-
-            if (boundary_pos == std::string::npos) {
-                std::cerr << "DEBUG: In MULTIPART_BODY, boundary length is: " << _multipartBoundary.length() << std::endl;
-                // Boundary not found. To avoid consuming a partial boundary at the end,
-                // we only process a "safe" part of the buffer, leaving a tail that
-                // might contain the start of a boundary.
-                size_t safe_consume_len = 0;
-                if (_multipartBuffer.length() > _multipartBoundary.length()) {
-                    safe_consume_len = _multipartBuffer.length() - _multipartBoundary.length();
-                }
+// File parts get a temp file in the upload directory; the part is renamed
+// to its final name only once it is complete.
+void HttpRequestParser::openPartFile() {
+    _uploadFailed = false;
+    if (!_isParsingFile || _uploadDir.empty()) return;
 
-                if (safe_consume_len > 0) {
-                    _currentPartBody.append(_multipartBuffer.substr(0, safe_consume_len));
-                    _multipartBuffer.erase(0, safe_consume_len);
-                    std::cerr << "DEBUG: No boundary found, consuming " << safe_consume_len << " bytes. Current part body length: " << _currentPartBody.length() << std::endl; fflush(stderr);
-                } else {
-                    std::cerr << "DEBUG: No boundary found, buffer too small to consume safely. Waiting for more data." << std::endl; fflush(stderr);
-                }
-                break; // We need more data to find the boundary.
-            }
+    _uploadTemp = _uploadDir + ".upload-XXXXXX";
+    std::vector<char> name(_uploadTemp.begin(), _uploadTemp.end());
+    name.push_back('\0');
+    _uploadFd = mkstemp(&name[0]);
+    if (_uploadFd < 0) {
+        std::cerr << "Upload: cannot create a temp file in " << _uploadDir << ": " << std::strerror(errno) << std::endl;
+        _uploadFailed = true;
+        return;
+    }
+    _uploadTemp = &name[0];
+    fcntl(_uploadFd, F_SETFD, FD_CLOEXEC);
+    fchmod(_uploadFd, 0644);
+    _uploadBuffer.resize(k_upload_buffer);
+    _uploadBuffered = 0;
+}
+
+void HttpRequestParser::flushPartFile() {
+    if (_uploadBuffered > 0) {
+        size_t buffered = _uploadBuffered;
+        _uploadBuffered = 0;
+        writePartFile(&_uploadBuffer[0], buffered);
+    }
+}
 
-            // Boundary was found. The data before it is the end of the current part's body.
-            std::string part_data = _multipartBuffer.substr(0, boundary_pos);
-            if (part_data.length() >= 2 && part_data.substr(part_data.length() - 2) == "\r\n") {
-                part_data.erase(part_data.length() - 2);
+// On a write error the part is dropped but the body is still parsed, so the
+// request can be answered.
+void HttpRequestParser::writePartFile(const char* data, size_t len) {
+    while (len > 0 && _uploadFd >= 0) {
+        ssize_t written = write(_uploadFd, data, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Upload: write to " << _uploadTemp << " failed: " << std::strerror(errno) << std::endl;
+            close(_uploadFd);
+            unlink(_uploadTemp.c_str());
+            _uploadFd = -1;
+            _uploadFailed = true;
+            return;
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+// Stores the part that just ended and resets for the next one.
+void HttpRequestParser::finishPart() {
+    if (_isParsingFile && (_uploadFd >= 0 || _uploadFailed)) {
+        // Basic sanitization: keep the name after the last path separator
+        std::string name = _currentFileName;
+        size_t last_slash = name.find_last_of("/");
+        if (last_slash == std::string::npos) {
+            last_slash = name.find_last_of("\\");
+        }
+        if (last_slash != std::string::npos) {
+            name = name.substr(last_slash + 1);
+        }
+        std::string path = _uploadDir + name;
+
+        flushPartFile();
+        if (_uploadFd >= 0) {
+            if (close(_uploadFd) != 0 || name.empty() || std::rename(_uploadTemp.c_str(), path.c_str()) != 0) {
+                std::cerr << "Upload: could not store " << path << ": " << std::strerror(errno) << std::endl;
+                unlink(_uploadTemp.c_str());
+                _uploadFailed = true;
             }
-            _currentPartBody.append(part_data);
-            std::cerr << "DEBUG: Found boundary at " << boundary_pos << ". Final part body length: " << _currentPartBody.length() << std::endl; fflush(stderr);
+            _uploadFd = -1;
+        }
+        _request.addStoredFile(_currentFieldName, _currentFileName, path, _uploadFailed);
+        _uploadFailed = false;
+    } else if (_isParsingFile) {
+        _request.addUploadedFile(_currentFieldName, _currentFileName, _currentPartBody);
+    } else {
+        _request.addFormField(_currentFieldName, _currentPartBody);
+    }
+    _currentPartBody.clear();
+    _isParsingFile = false;
+    _currentFileName.clear();
+    _currentFieldName.clear();
+}
 
-            // Store the completed part
-            if (_isParsingFile) {
-                _request.addUploadedFile(_currentFieldName, _currentFileName, _currentPartBody);
-                std::cerr << "DEBUG: Added uploaded file: " << _currentFileName << " (Field: " << _currentFieldName << ")" << std::endl; fflush(stderr);
-            } else {
-                _request.addFormField(_currentFieldName, _currentPartBody);
-                std::cerr << "DEBUG: Added form field: " << _currentFieldName << " = '" << _currentPartBody << "'" << std::endl; fflush(stderr);
+// Reads Content-Disposition's name and filename from a part's headers.
+void HttpRequestParser::parsePartHeaders(const std::string& headers_str) {
+    _currentPartHeaders = headers_str;
+    std::stringstream ss_headers(headers_str);
+    std::string line;
+    _isParsingFile = false;
+    _currentFileName = "";
+    _currentFieldName = "";
+
+    while (std::getline(ss_headers, line)) {
+        if (!line.empty() && line[line.length() - 1] == '\r') {
+            line.erase(line.length() - 1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        size_t colon_pos = line.find(":");
+        if (colon_pos != std::string::npos) {
+            std::string key = line.substr(0, colon_pos);
+            std::string value = line.substr(colon_pos + 1);
+            size_t first_char = value.find_first_not_of(" \t");
+            if (first_char != std::string::npos) {
+                value = value.substr(first_char);
             }
 
-            // Reset for the next part
-            _currentPartBody.clear();
-            _isParsingFile = false;
-            _currentFileName.clear();
-            _currentFieldName.clear();
-
-            // Consume the boundary from the buffer
-            _multipartBuffer.erase(0, boundary_pos);
-
-            // Check if it's an end boundary ("--") and consume it
-            if (_multipartBuffer.length() >= _multipartBoundary.length() + 2 && _multipartBuffer.substr(_multipartBoundary.length(), 2) == "--") {
-                _multipartBuffer.erase(0, _multipartBoundary.length() + 2);
-                 // Consume trailing CRLF
-                if (_multipartBuffer.length() >= 2 && _multipartBuffer.substr(0, 2) == "\r\n") {
-                    _multipartBuffer.erase(0, 2);
+            if (key == "Content-Disposition") {
+                size_t filename_pos = value.find("filename=\"");
+                if (filename_pos != std::string::npos) {
+                    _isParsingFile = true;
+                    size_t filename_start = filename_pos + 10;
+                    size_t filename_end = value.find("\"", filename_start);
+                    if (filename_end != std::string::npos) {
+                        _currentFileName = value.substr(filename_start, filename_end - filename_start);
+                    }
                 }
-                _multipartState = MULTIPART_END;
-                std::cerr << "DEBUG: Found end boundary. Transitioning to MULTIPART_END." << std::endl; fflush(stderr);
-            } else {
-                // It's a regular boundary, consume it and the trailing CRLF
-                _multipartBuffer.erase(0, _multipartBoundary.length());
-                if (_multipartBuffer.length() >= 2 && _multipartBuffer.substr(0, 2) == "\r\n") {
-                    _multipartBuffer.erase(0, 2);
+                size_t name_pos = value.find("name=\"");
+                if (name_pos != std::string::npos) {
+                    size_t name_start = name_pos + 6;
+                    size_t name_end = value.find("\"", name_start);
+                    if (name_end != std::string::npos) {
+                        _currentFieldName = value.substr(name_start, name_end - name_start);
+                    }
                 }
-                _multipartState = MULTIPART_HEADERS;
-                std::cerr << "DEBUG: Found part boundary. Transitioning to MULTIPART_HEADERS for next part." << std::endl; fflush(stderr);
             }
         }
     }
 }
+
+// Walks the body with a cursor instead of erasing from the front. Between
+// calls _multipartBuffer keeps only what may still be the start of a
+// delimiter (or an incomplete part head), so each byte is copied and
+// scanned a bounded number of times. The opening boundary is
+// matched as a delimiter too: endOfHeaders() seeds the buffer with CRLF,
+// which also lets a preamble be skipped.
+size_t HttpRequestParser::parseMultipartBody(const char* data, size_t len) {
+    if (_multipartState == MULTIPART_END) {
+        return len; // Epilogue, up to Content-Length
+    }
+    _multipartBuffer.append(data, len);
+    const char* buf = _multipartBuffer.data();
+    const char* end = buf + _multipartBuffer.size();
+    const char* p = buf;
+    size_t n = _delimiter.length();
+
+    while (_multipartState != MULTIPART_END) {
+        if (_multipartState == MULTIPART_HEADERS) {
+            // p is at the CRLF that ends the boundary line
+            const char* head_end = ByteScan::findString(p, end, k_part_head_end);
+            if (!head_end) break; // Not enough data for the part headers
+            const char* headers = std::min(p + 2, head_end);
+            parsePartHeaders(std::string(headers, head_end - headers));
+            openPartFile();
+            p = head_end + k_part_head_end.length();
+            _multipartState = MULTIPART_BODY;
+            continue;
+        }
+
+        // MULTIPART_START (preamble) or MULTIPART_BODY
+        const char* hit = findDelimiter(p, end);
+        if (!hit || static_cast<size_t>(end - hit) < n + 2) {
+            // Only the last n - 1 bytes (or a delimiter still missing the two
+            // bytes after it) can start a delimiter; the rest is part data.
+            const char* keep = hit ? hit : end - std::min<size_t>(end - p, n - 1);
+            if (_multipartState == MULTIPART_BODY) appendPartData(p, keep - p);
+            p = keep;
+            break;
+        }
+        if (_multipartState == MULTIPART_BODY) {
+            appendPartData(p, hit - p);
+            finishPart();
+        }
+        p = hit + n;
+        if (p[0] == '-' && p[1] == '-') {
+            p += 2;
+            if (end - p >= 2 && p[0] == '\r' && p[1] == '\n') p += 2;
+            if (_contentLength > 0) p = end; // The epilogue is part of the body
+            _multipartState = MULTIPART_END;
+        } else {
+            _multipartState = MULTIPART_HEADERS;
+        }
+    }
+
+    size_t left = end - p;
+    if (_multipartState == MULTIPART_END) {
+        // Whatever follows the closing boundary is not ours
+        _multipartBuffer.clear();
+        return len - left;
+    }
+    _multipartBuffer.erase(0, p - buf);
+    return len;
+}
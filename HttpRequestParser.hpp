@@ -21,22 +21,61 @@ public:
     HttpRequestParser();
     ~HttpRequestParser();
 
-    ParsingState parse(std::string& buffer); // Feed new data to the parser
+    // Feeds new data to the parser and returns how many bytes of it belong
+    // to this request; parsing stops once the request is complete, and
+    // right after the head when a body follows, so the caller can decide
+    // where the body goes.
+    size_t parse(const char* data, size_t len);
     const HttpRequest& getRequest() const; // Get the built HttpRequest object
+    // File parts of a multipart body are streamed into `dir` (ending in '/')
+    // as they arrive instead of being kept in memory.
+    void setUploadDir(const std::string& dir);
+    // The caller read the body itself (a PUT): the request is complete.
+    void skipBody();
     ParsingState getState() const; // Get current parsing state
+    size_t getBodySize() const; // Body bytes received, streamed parts included
+    // Bytes of file parts handed to their temp files (or dropped after a
+    // write error) rather than kept in memory.
+    size_t getStreamedBytes() const;
+    // Status to answer a PARSING_ERROR with: 400, 413, 414 or 431.
+    int getErrorStatus() const;
+    // Largest body accepted; a chunked or multipart body is cut off at it
+    // as it arrives. Unlimited until the caller routed the head.
+    void setBodyLimit(size_t limit);
+    // Caps on the request line plus header fields, in bytes, and on the
+    // number of header fields; process-wide, from the configuration.
+    static void setHeadLimits(size_t max_size, size_t max_fields);
 
 private:
-    void parseRequestLine(const std::string& line);
-    void parseHeader(const std::string& line);
-    void parseBody(std::string& data); // Will operate on passed data
-    void parseChunkedBody(std::string& data); // Will operate on passed data
-    void parseMultipartBody(std::string& data); // New method for multipart/form-data
+    void fail(int status);
+    bool takeHeadLine(const char* data, size_t len, size_t& pos, size_t& line, size_t& line_len);
+    void parseRequestLine(size_t line, size_t len);
+    void parseHeader(size_t line, size_t len);
+    void endOfHeaders();
+    size_t parseBody(const char* data, size_t len);
+    size_t parseChunkedBody(const char* data, size_t len);
+    size_t parseMultipartBody(const char* data, size_t len); // New method for multipart/form-data
+    void buildDelimiterSkip();
+    const char* findDelimiter(const char* p, const char* end) const;
+    void parsePartHeaders(const std::string& headers_str);
+    void appendPartData(const char* data, size_t len);
+    void finishPart();
+    void openPartFile();
+    void flushPartFile();
+    void writePartFile(const char* data, size_t len);
 
     HttpRequest _request;
     ParsingState _state;
-    // No internal buffer, operate directly on the passed string reference
+    // Start of the head line being read, as an offset in the request's head
+    // buffer; bytes before it were parsed already and are never rescanned.
+    size_t _lineStart;
     size_t _contentLength; // For non-chunked body
     size_t _bodyBytesRead; // For non-chunked body
+    size_t _bodyLimit;
+    size_t _headerCount;
+    int _errorStatus;
+    static size_t _maxHeadSize;
+    static size_t _maxHeaderCount;
 
     // For chunked transfer-encoding
     enum ChunkState {
@@ -48,7 +87,7 @@ private:
     } _chunkState;
     size_t _currentChunkSize;
     size_t _bytesReadInChunk;
-    // No _chunkBuffer here, parseChunkedBody will operate directly on _buffer
+    std::string _chunkLine; // Chunk size or trailer line split across reads
 
     // For multipart/form-data parsing
     std::string _multipartBoundary;
@@ -57,13 +96,24 @@ private:
     bool _isParsingFile;
     std::string _currentFileName;
     std::string _currentFieldName;
-    std::string _multipartBuffer;
+    std::string _multipartBuffer; // Unconsumed tail: a possible delimiter prefix or part head
+    std::string _delimiter;       // "\r\n--boundary", searched with Boyer-Moore-Horspool
+    unsigned char _delimiterSkip[256];
     enum MultipartState {
         MULTIPART_START,
         MULTIPART_HEADERS,
         MULTIPART_BODY,
         MULTIPART_END
     } _multipartState;
+
+    // Streaming of file parts to disk
+    std::string _uploadDir;
+    std::string _uploadTemp; // Temp file of the part being received
+    int _uploadFd;
+    bool _uploadFailed;
+    std::vector<char> _uploadBuffer; // Fixed size, flushed when full
+    size_t _uploadBuffered;
+    size_t _streamedBytes;
 }; // MISSING CLOSING BRACE FOR CLASS
 
 
@@ -14,11 +14,20 @@ void HttpResponse::addHeader(const std::string& key, const std::string& value) {
     _headers[key] = value;
 }
 
+std::string HttpResponse::getHeader(const std::string& key) const {
+    std::map<std::string, std::string>::const_iterator it = _headers.find(key);
+    return it == _headers.end() ? "" : it->second;
+}
+
 void HttpResponse::setBody(const std::string& body) {
     _body = body;
 }
 
 std::string HttpResponse::toString() const {
+    return headersToString() + _body;
+}
+
+std::string HttpResponse::headersToString() const {
     std::stringstream ss;
 
     // Status line
@@ -32,9 +41,6 @@ std::string HttpResponse::toString() const {
     // Blank line before body
     ss << "\r\n";
 
-    // Body
-    ss << _body;
-
     return ss.str();
 }
 
@@ -11,9 +11,11 @@ public:
 
     void setStatusCode(int code, const std::string& message);
     void addHeader(const std::string& key, const std::string& value);
+    std::string getHeader(const std::string& key) const; // Exact name; empty if unset
     void setBody(const std::string& body);
 
     std::string toString() const;
+    std::string headersToString() const; // Status line and headers, without the body
 
 private:
     int _statusCode;
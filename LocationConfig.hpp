@@ -3,11 +3,23 @@
 
 #include <string>
 #include <map> // Added for std::map
+#include <vector>
 
 struct LocationConfig {
-    std::string path;
+    // Location modifier, as in nginx
+    enum Match {
+        MATCH_PREFIX,           // location /path
+        MATCH_PREFIX_NO_REGEX,  // location ^~ /path: skips regexes when longest
+        MATCH_EXACT,            // location = /path
+        MATCH_REGEX,            // location ~ regex
+        MATCH_REGEX_ICASE       // location ~* regex
+    };
+
+    size_t id; // Position in the server's location list
+    Match match;
+    std::string path; // The regex for regex locations
     std::string root;
-    std::string index;
+    std::vector<std::string> index; // Tried in order for directory requests
     std::string cgi_path;
     std::string cgi_ext;
     size_t client_max_body_size;
@@ -16,8 +28,25 @@ struct LocationConfig {
     std::string redirect; // New member for HTTP redirection
     std::string upload_path; // New member for upload directory
     bool autoindex; // New member for directory listing
+    size_t autoindex_page_size; // Entries per listing page, 0 lists everything
+    bool stats; // Serve the server's counters as text/plain
+    bool gzip_static; // Serve fresh .br/.gz sidecars to clients that accept them
+    // On-the-fly compression of generated bodies (CGI output, autoindex)
+    bool gzip;
+    int gzip_comp_level;
+    size_t gzip_min_length;
+    std::vector<std::string> gzip_types; // text/html is always included, "*" allows any
+    // Timeouts in milliseconds, -1 inherits the server-level value, 0 disables
+    long client_header_timeout;
+    long client_body_timeout;
+    long keepalive_timeout;
+    long send_timeout;
+    long expires; // Seconds added to the response time for Expires/max-age, -1 is off
+    std::string cache_control; // Sent verbatim, overrides the max-age from expires
 
-    LocationConfig() : client_max_body_size(1 * 1024 * 1024), autoindex(false) {} // Default 1MB, autoindex off
+    LocationConfig() : id(0), match(MATCH_PREFIX), client_max_body_size(1 * 1024 * 1024), autoindex(false), autoindex_page_size(0), stats(false), gzip_static(false),
+        gzip(false), gzip_comp_level(1), gzip_min_length(20),
+        client_header_timeout(-1), client_body_timeout(-1), keepalive_timeout(-1), send_timeout(-1), expires(-1) {} // Default 1MB, autoindex off
 };
 
 #endif
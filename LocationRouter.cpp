@@ -0,0 +1,123 @@
+#include "LocationRouter.hpp"
+#include <stdexcept>
+
+LocationRouter::LocationRouter() : _root(_newNode("")) {}
+
+LocationRouter::~LocationRouter() {
+    _clear();
+    delete _root;
+}
+
+LocationRouter::Node* LocationRouter::_newNode(const std::string& label) {
+    Node* node = new Node;
+    node->label = label;
+    node->prefix = NULL;
+    node->exact = NULL;
+    return node;
+}
+
+void LocationRouter::_deleteTree(Node* node) {
+    for (size_t i = 0; i < node->children.size(); ++i) _deleteTree(node->children[i]);
+    delete node;
+}
+
+void LocationRouter::_clear() {
+    for (size_t i = 0; i < _root->children.size(); ++i) _deleteTree(_root->children[i]);
+    _root->children.clear();
+    _root->prefix = NULL;
+    _root->exact = NULL;
+    for (size_t i = 0; i < _regexes.size(); ++i) regfree(&_regexes[i].compiled);
+    _regexes.clear();
+}
+
+void LocationRouter::build(const std::vector<LocationConfig*>& locations) {
+    _clear();
+    for (size_t i = 0; i < locations.size(); ++i) {
+        const LocationConfig* loc = locations[i];
+        if (loc->match == LocationConfig::MATCH_REGEX || loc->match == LocationConfig::MATCH_REGEX_ICASE) {
+            Regex regex;
+            regex.loc = loc;
+            int flags = REG_EXTENDED | REG_NOSUB;
+            if (loc->match == LocationConfig::MATCH_REGEX_ICASE) flags |= REG_ICASE;
+            int err = regcomp(&regex.compiled, loc->path.c_str(), flags);
+            if (err != 0) {
+                char message[256];
+                regerror(err, &regex.compiled, message, sizeof(message));
+                throw std::runtime_error("Invalid location regex '" + loc->path + "': " + message);
+            }
+            _regexes.push_back(regex);
+        } else {
+            _insert(loc, loc->match == LocationConfig::MATCH_EXACT);
+        }
+    }
+}
+
+// Binary search on the first byte: children never share one.
+LocationRouter::Node* LocationRouter::_child(const Node* node, unsigned char first) {
+    size_t lo = 0, hi = node->children.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        unsigned char c = static_cast<unsigned char>(node->children[mid]->label[0]);
+        if (c == first) return node->children[mid];
+        if (c < first) lo = mid + 1;
+        else hi = mid;
+    }
+    return NULL;
+}
+
+// Standard radix insert: follow matching edges, splitting the edge where
+// the path diverges. The first location for a path wins, as with the old
+// longest-match scan.
+void LocationRouter::_insert(const LocationConfig* loc, bool exact) {
+    const std::string& path = loc->path;
+    Node* node = _root;
+    size_t pos = 0;
+    while (pos < path.size()) {
+        Node* child = _child(node, static_cast<unsigned char>(path[pos]));
+        if (!child) {
+            child = _newNode(path.substr(pos));
+            std::vector<Node*>::iterator it = node->children.begin();
+            while (it != node->children.end() && static_cast<unsigned char>((*it)->label[0]) < static_cast<unsigned char>(path[pos])) ++it;
+            node->children.insert(it, child);
+            node = child;
+            pos = path.size();
+            break;
+        }
+        size_t common = 0;
+        while (common < child->label.size() && pos + common < path.size() && child->label[common] == path[pos + common]) ++common;
+        if (common < child->label.size()) {
+            // Split: `child` keeps the tail of its label under a new middle node.
+            Node* middle = _newNode(child->label.substr(0, common));
+            child->label.erase(0, common);
+            middle->children.push_back(child);
+            for (size_t i = 0; i < node->children.size(); ++i) {
+                if (node->children[i] == child) node->children[i] = middle;
+            }
+            child = middle;
+        }
+        node = child;
+        pos += common;
+    }
+    const LocationConfig*& slot = exact ? node->exact : node->prefix;
+    if (!slot) slot = loc;
+}
+
+const LocationConfig* LocationRouter::find(const std::string& uri) const {
+    const Node* node = _root;
+    const LocationConfig* longest = node->prefix;
+    size_t pos = 0;
+    while (pos < uri.size()) {
+        const Node* child = _child(node, static_cast<unsigned char>(uri[pos]));
+        if (!child || uri.compare(pos, child->label.size(), child->label) != 0) break;
+        node = child;
+        pos += child->label.size();
+        if (node->prefix) longest = node->prefix;
+    }
+    if (pos == uri.size() && node->exact) return node->exact;
+    if (longest && longest->match == LocationConfig::MATCH_PREFIX_NO_REGEX) return longest;
+
+    for (size_t i = 0; i < _regexes.size(); ++i) {
+        if (regexec(&_regexes[i].compiled, uri.c_str(), 0, NULL, 0) == 0) return _regexes[i].loc;
+    }
+    return longest;
+}
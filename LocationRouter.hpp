@@ -0,0 +1,49 @@
+#ifndef LOCATION_ROUTER_HPP
+#define LOCATION_ROUTER_HPP
+
+#include <regex.h>
+#include <string>
+#include <vector>
+#include "LocationConfig.hpp"
+
+// Locations compiled for request routing, with nginx precedence: an exact
+// (`=`) match wins, then the longest prefix if it is `^~`, then the first
+// regex (`~`, `~*` ignoring case) in config order, then the longest prefix.
+// Prefix and exact locations live in one radix tree, so both come out of a
+// single pass over the URI; only regex locations are tried one by one.
+class LocationRouter {
+public:
+    LocationRouter();
+    ~LocationRouter();
+
+    // Compiles the locations; throws std::runtime_error on a bad regex.
+    // The router keeps pointers to them, not copies.
+    void build(const std::vector<LocationConfig*>& locations);
+    const LocationConfig* find(const std::string& uri) const;
+
+private:
+    struct Node {
+        std::string label; // Edge from the parent, never empty below the root
+        const LocationConfig* prefix;
+        const LocationConfig* exact;
+        std::vector<Node*> children; // Sorted by the first byte of their label
+    };
+    struct Regex {
+        regex_t compiled;
+        const LocationConfig* loc;
+    };
+
+    LocationRouter(const LocationRouter&);
+    LocationRouter& operator=(const LocationRouter&);
+
+    void _insert(const LocationConfig* loc, bool exact);
+    void _clear();
+    static Node* _newNode(const std::string& label);
+    static Node* _child(const Node* node, unsigned char first);
+    static void _deleteTree(Node* node);
+
+    Node* _root;
+    std::vector<Regex> _regexes;
+};
+
+#endif // LOCATION_ROUTER_HPP
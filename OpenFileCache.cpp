@@ -0,0 +1,92 @@
+#include "OpenFileCache.hpp"
+#include "TimerWheel.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+
+OpenFileCache::OpenFileCache(size_t max_entries, unsigned long inactive_ms, unsigned long valid_ms) :
+    _max_entries(max_entries),
+    _inactive_ms(inactive_ms),
+    _valid_ms(valid_ms),
+    _hits(0),
+    _misses(0)
+{}
+
+OpenFileCache::~OpenFileCache() {
+    while (!_index.empty()) _erase(_index.begin());
+}
+
+// Opens a regular file. Returns NULL if it is missing or not a regular file.
+static OpenFileCache::File* openFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+    OpenFileCache::File* file = new OpenFileCache::File;
+    file->path = path;
+    file->fd = fd;
+    file->st = st;
+    file->used_ms = TimerWheel::nowMs();
+    file->validated_ms = file->used_ms;
+    file->refs = 1;
+    return file;
+}
+
+OpenFileCache::File* OpenFileCache::acquire(const std::string& path) {
+    if (_max_entries == 0) return openFile(path);
+
+    unsigned long now = TimerWheel::nowMs();
+    FileIndex::iterator it = _index.find(path);
+    if (it != _index.end()) {
+        File* file = *it->second;
+        bool fresh = true;
+        if (now - file->validated_ms >= _valid_ms) {
+            struct stat st;
+            fresh = (stat(path.c_str(), &st) == 0 && st.st_ino == file->st.st_ino && st.st_dev == file->st.st_dev
+                     && st.st_size == file->st.st_size && st.st_mtime == file->st.st_mtime);
+            file->validated_ms = now;
+        }
+        if (fresh) {
+            _lru.splice(_lru.begin(), _lru, it->second);
+            file->used_ms = now;
+            ++file->refs;
+            ++_hits;
+            return file;
+        }
+        _erase(it);
+    }
+
+    ++_misses;
+    File* file = openFile(path);
+    if (!file) return NULL;
+    while (_index.size() >= _max_entries) _erase(_index.find(_lru.back()->path));
+    ++file->refs; // The cache's own reference
+    _lru.push_front(file);
+    _index[path] = _lru.begin();
+    return file;
+}
+
+void OpenFileCache::release(File* file) {
+    if (!file || --file->refs > 0) return;
+    close(file->fd);
+    delete file;
+}
+
+void OpenFileCache::expire(unsigned long now_ms) {
+    while (!_lru.empty() && now_ms - _lru.back()->used_ms >= _inactive_ms) {
+        _erase(_index.find(_lru.back()->path));
+    }
+}
+
+void OpenFileCache::_erase(FileIndex::iterator it) {
+    File* file = *it->second;
+    _lru.erase(it->second);
+    _index.erase(it);
+    release(file);
+}
+
+unsigned long OpenFileCache::getHits() const { return _hits; }
+unsigned long OpenFileCache::getMisses() const { return _misses; }
+size_t OpenFileCache::getEntryCount() const { return _index.size(); }
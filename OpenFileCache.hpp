@@ -0,0 +1,59 @@
+#ifndef OPEN_FILE_CACHE_HPP
+#define OPEN_FILE_CACHE_HPP
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <list>
+#include <map>
+#include <string>
+
+// Keeps regular files open together with their fstat() metadata, so a hot
+// path costs no open()/fstat()/close() per request. Handles are refcounted:
+// a response streaming from the fd holds it, and an entry evicted, expired
+// or found stale meanwhile is closed once its last holder releases it.
+// Entries unused for `inactive_ms` are closed; the path is stat()ed again
+// at most once every `valid_ms` to notice replaced or modified files.
+class OpenFileCache {
+public:
+    struct File {
+        std::string path;
+        int fd;
+        struct stat st;
+        unsigned long used_ms;
+        unsigned long validated_ms;
+        unsigned int refs; // Holders, plus one while cached
+    };
+
+    OpenFileCache(size_t max_entries, unsigned long inactive_ms, unsigned long valid_ms);
+    ~OpenFileCache();
+
+    // Returns a held handle on the regular file at `path`, or NULL if it is
+    // missing or not a regular file. Every handle goes back through release().
+    File* acquire(const std::string& path);
+    static void release(File* file);
+    // Closes the entries that were not used within the inactivity timeout.
+    void expire(unsigned long now_ms);
+
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+    size_t getEntryCount() const;
+
+private:
+    typedef std::list<File*> FileList;
+    typedef std::map<std::string, FileList::iterator> FileIndex;
+
+    OpenFileCache(const OpenFileCache&);
+    OpenFileCache& operator=(const OpenFileCache&);
+
+    void _erase(FileIndex::iterator it);
+
+    size_t _max_entries;
+    unsigned long _inactive_ms;
+    unsigned long _valid_ms;
+    FileList _lru; // Most recently used first
+    FileIndex _index;
+    unsigned long _hits;
+    unsigned long _misses;
+};
+
+#endif // OPEN_FILE_CACHE_HPP
@@ -0,0 +1,140 @@
+#include "PathCache.hpp"
+#include "TimerWheel.hpp"
+#include <unistd.h>
+#include <cerrno>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+PathCache::PathCache(size_t max_entries, unsigned long ttl_ms) :
+    _max_entries(max_entries),
+    _ttl_ms(ttl_ms),
+    _inotify_fd(-1),
+    _hits(0),
+    _misses(0),
+    _invalidations(0)
+{}
+
+PathCache::~PathCache() {
+    if (_inotify_fd >= 0) close(_inotify_fd);
+}
+
+int PathCache::enableInotify() {
+#ifdef __linux__
+    if (_inotify_fd < 0 && _max_entries > 0) {
+        _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+#endif
+    return _inotify_fd;
+}
+
+void PathCache::handleInotify() {
+#ifdef __linux__
+    char buffer[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t n = read(_inotify_fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        for (ssize_t off = 0; off < n; ) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + off);
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost: nothing cached can be trusted.
+                while (!_index.empty()) _erase(_index.begin());
+            } else {
+                _invalidateWatch(event->wd);
+            }
+            off += sizeof(struct inotify_event) + event->len;
+        }
+    }
+#endif
+}
+
+void PathCache::_invalidateWatch(int wd) {
+    std::map<int, std::set<std::string> >::iterator watch = _watch_keys.find(wd);
+    if (watch == _watch_keys.end()) return;
+    // Erasing the last key of a watch removes it, so work on a copy.
+    std::set<std::string> keys = watch->second;
+    for (std::set<std::string>::const_iterator key = keys.begin(); key != keys.end(); ++key) {
+        EntryIndex::iterator it = _index.find(*key);
+        if (it != _index.end()) {
+            _erase(it);
+            ++_invalidations;
+        }
+    }
+}
+
+const PathCache::Entry* PathCache::lookup(const std::string& key) {
+    EntryIndex::iterator it = _index.find(key);
+    if (it == _index.end()) {
+        ++_misses;
+        return NULL;
+    }
+    if (TimerWheel::nowMs() >= it->second->expires_ms) {
+        _erase(it);
+        ++_misses;
+        return NULL;
+    }
+    _lru.splice(_lru.begin(), _lru, it->second);
+    ++_hits;
+    return &*it->second;
+}
+
+void PathCache::store(const std::string& key, Kind kind, const std::string& path, const std::vector<std::string>& dirs) {
+    if (_max_entries == 0) return;
+    EntryIndex::iterator existing = _index.find(key);
+    if (existing != _index.end()) _erase(existing);
+
+    Entry entry;
+    entry.key = key;
+    entry.kind = kind;
+    entry.path = path;
+    entry.expires_ms = TimerWheel::nowMs() + _ttl_ms;
+#ifdef __linux__
+    if (_inotify_fd >= 0) {
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            int wd = inotify_add_watch(_inotify_fd, dirs[i].c_str(),
+                IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ATTRIB);
+            if (wd < 0) continue; // Out of watches: the TTL still applies
+            entry.watches.push_back(wd);
+            _watch_keys[wd].insert(key);
+        }
+    }
+#else
+    (void)dirs;
+#endif
+
+    while (_index.size() >= _max_entries && !_lru.empty()) {
+        _erase(_index.find(_lru.back().key));
+    }
+    _lru.push_front(entry);
+    _index[key] = _lru.begin();
+}
+
+void PathCache::erase(const std::string& key) {
+    EntryIndex::iterator it = _index.find(key);
+    if (it != _index.end()) _erase(it);
+}
+
+// Drops an entry and any watch no other entry depends on.
+void PathCache::_erase(EntryIndex::iterator it) {
+    const Entry& entry = *it->second;
+    for (size_t i = 0; i < entry.watches.size(); ++i) {
+        int wd = entry.watches[i];
+        std::map<int, std::set<std::string> >::iterator watch = _watch_keys.find(wd);
+        if (watch == _watch_keys.end()) continue;
+        watch->second.erase(entry.key);
+        if (watch->second.empty()) {
+#ifdef __linux__
+            inotify_rm_watch(_inotify_fd, wd);
+#endif
+            _watch_keys.erase(watch);
+        }
+    }
+    _lru.erase(it->second);
+    _index.erase(it);
+}
+
+unsigned long PathCache::getHits() const { return _hits; }
+unsigned long PathCache::getMisses() const { return _misses; }
+unsigned long PathCache::getInvalidations() const { return _invalidations; }
+size_t PathCache::getEntryCount() const { return _index.size(); }
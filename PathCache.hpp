@@ -0,0 +1,72 @@
+#ifndef PATH_CACHE_HPP
+#define PATH_CACHE_HPP
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Remembers how a GET path resolved on the filesystem (the file actually
+// served after the .html fallback and index lookup, a directory to list,
+// or nothing at all), so repeated hits and misses skip the stat()/open()
+// probes. Entries expire after a TTL; on Linux they are also dropped as
+// soon as inotify reports a change in a directory they depend on.
+class PathCache {
+public:
+    enum Kind {
+        PATH_ABSENT,
+        PATH_FILE,
+        PATH_DIRECTORY
+    };
+
+    struct Entry {
+        std::string key;
+        Kind kind;
+        std::string path;
+        unsigned long expires_ms;
+        std::vector<int> watches; // inotify watch descriptors
+    };
+
+    PathCache(size_t max_entries, unsigned long ttl_ms);
+    ~PathCache();
+
+    // Starts watching directories with inotify. Returns the descriptor to
+    // poll, or -1 where inotify is unavailable (entries then rely on the
+    // TTL alone). Call it in the process that runs the event loop.
+    int enableInotify();
+    // Drains the inotify descriptor and drops the entries it invalidates.
+    void handleInotify();
+
+    const Entry* lookup(const std::string& key);
+    // `dirs` are the directories whose changes can alter the result.
+    void store(const std::string& key, Kind kind, const std::string& path, const std::vector<std::string>& dirs);
+    void erase(const std::string& key);
+
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+    unsigned long getInvalidations() const;
+    size_t getEntryCount() const;
+
+private:
+    typedef std::list<Entry> EntryList;
+    typedef std::map<std::string, EntryList::iterator> EntryIndex;
+
+    PathCache(const PathCache&);
+    PathCache& operator=(const PathCache&);
+
+    void _erase(EntryIndex::iterator it);
+    void _invalidateWatch(int wd);
+
+    size_t _max_entries;
+    unsigned long _ttl_ms;
+    EntryList _lru; // Most recently used first
+    EntryIndex _index;
+    int _inotify_fd;
+    std::map<int, std::set<std::string> > _watch_keys; // Keys depending on each watch
+    unsigned long _hits;
+    unsigned long _misses;
+    unsigned long _invalidations;
+};
+
+#endif // PATH_CACHE_HPP
@@ -0,0 +1,48 @@
+#include "Poller.hpp"
+#include "SelectPoller.hpp"
+#include "EpollPoller.hpp"
+#include <stdexcept>
+
+Poller::~Poller() {}
+
+void Poller::setWriteInterest(int fd, bool enabled) {
+    int current = getInterest(fd);
+    if (current == 0) return; // Not registered (already closed)
+
+    int wanted = enabled ? (current | EVENT_WRITE) : (current & ~EVENT_WRITE);
+    if (wanted != current) {
+        modify(fd, wanted);
+    }
+}
+
+int Poller::getInterest(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= _interest.size()) return 0;
+    return _interest[fd];
+}
+
+void Poller::_setInterest(int fd, int events) {
+    if (fd < 0) return;
+    if (static_cast<size_t>(fd) >= _interest.size()) {
+        _interest.resize(fd + 1, 0);
+    }
+    _interest[fd] = events;
+}
+
+Poller* Poller::create(const std::string& backend) {
+    if (backend == "select") {
+        return new SelectPoller();
+    }
+#ifdef __linux__
+    if (backend.empty() || backend == "epoll") {
+        return new EpollPoller();
+    }
+#else
+    if (backend.empty()) {
+        return new SelectPoller();
+    }
+    if (backend == "epoll") {
+        throw std::runtime_error("event_backend epoll is not available on this platform");
+    }
+#endif
+    throw std::runtime_error("Unknown event_backend: " + backend);
+}
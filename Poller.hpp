@@ -0,0 +1,47 @@
+#ifndef POLLER_HPP
+#define POLLER_HPP
+
+#include <string>
+#include <vector>
+
+// Readiness notification backend used by the Server event loop.
+// Implementations only hand back descriptors that are actually ready, and
+// the interest mask of every registered fd is tracked here so callers can
+// toggle write interest per connection without remembering read interest.
+class Poller {
+public:
+    enum EventMask {
+        EVENT_READ = 1,
+        EVENT_WRITE = 2,
+        EVENT_ERROR = 4
+    };
+
+    struct Event {
+        int fd;
+        int events;
+    };
+
+    virtual ~Poller();
+
+    virtual const char* name() const = 0;
+    virtual bool add(int fd, int events) = 0;
+    virtual void modify(int fd, int events) = 0;
+    virtual void remove(int fd) = 0;
+    // Fills `ready` with the fds that have pending events. Returns the number
+    // of ready fds, or -1 on error (errno is preserved). timeout_ms < 0 blocks.
+    virtual int wait(std::vector<Event>& ready, int timeout_ms) = 0;
+
+    void setWriteInterest(int fd, bool enabled);
+    int getInterest(int fd) const;
+
+    // Builds the backend named in the config ("epoll" or "select").
+    // An empty name picks the best backend available on this platform.
+    static Poller* create(const std::string& backend);
+
+protected:
+    void _setInterest(int fd, int events);
+
+    std::vector<int> _interest; // Indexed by fd, 0 means not registered
+};
+
+#endif // POLLER_HPP
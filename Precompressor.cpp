@@ -0,0 +1,200 @@
+#include "Precompressor.hpp"
+#include "Server.hpp" // For getMimeType
+#include <pthread.h>
+#include <zlib.h>
+#ifdef WEBSERV_BROTLI
+#include <brotli/encode.h>
+#endif
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <algorithm>
+
+// Files smaller than this gain nothing from compression.
+static const off_t k_min_size = 256;
+
+struct PrecompressJob {
+    std::vector<std::string> files;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static bool isSidecar(const std::string& name) {
+    size_t len = name.length();
+    return (len > 3 && name.compare(len - 3, 3, ".gz") == 0)
+        || (len > 3 && name.compare(len - 3, 3, ".br") == 0)
+        || (len > 4 && name.compare(len - 4, 4, ".tmp") == 0);
+}
+
+static void collect(const std::string& dir, std::vector<std::string>& files) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+    struct dirent* ent;
+    while ((ent = readdir(d)) != NULL) {
+        std::string name = ent->d_name;
+        if (name == "." || name == ".." || isSidecar(name)) continue;
+        std::string path = dir + (dir[dir.length() - 1] == '/' ? "" : "/") + name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            collect(path, files);
+        } else if (S_ISREG(st.st_mode) && st.st_size >= k_min_size && Precompressor::isCompressible(path)) {
+            files.push_back(path);
+        }
+    }
+    closedir(d);
+}
+
+static bool isFresh(const std::string& sidecar, const struct stat& source) {
+    struct stat st;
+    return stat(sidecar.c_str(), &st) == 0 && st.st_mtime >= source.st_mtime;
+}
+
+static bool writeGzip(int in_fd, const std::string& out_path) {
+    gzFile out = gzopen(out_path.c_str(), "wb9");
+    if (!out) return false;
+    char buffer[65536];
+    ssize_t n;
+    bool ok = true;
+    while (ok && (n = read(in_fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+        } else {
+            ok = gzwrite(out, buffer, static_cast<unsigned>(n)) == n;
+        }
+    }
+    return gzclose(out) == Z_OK && ok;
+}
+
+#ifdef WEBSERV_BROTLI
+static bool writeBrotli(int in_fd, const std::string& out_path) {
+    FILE* out = fopen(out_path.c_str(), "wb");
+    if (!out) return false;
+    BrotliEncoderState* enc = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+    BrotliEncoderSetParameter(enc, BROTLI_PARAM_QUALITY, 11);
+
+    uint8_t in_buf[65536];
+    uint8_t out_buf[65536];
+    size_t avail_in = 0;
+    const uint8_t* next_in = in_buf;
+    bool eof = false;
+    bool ok = true;
+    while (ok) {
+        if (avail_in == 0 && !eof) {
+            ssize_t n = read(in_fd, in_buf, sizeof(in_buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) { ok = false; break; }
+            eof = (n == 0);
+            avail_in = static_cast<size_t>(n);
+            next_in = in_buf;
+        }
+        size_t avail_out = sizeof(out_buf);
+        uint8_t* next_out = out_buf;
+        if (!BrotliEncoderCompressStream(enc, eof ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS,
+                                         &avail_in, &next_in, &avail_out, &next_out, NULL)) {
+            ok = false;
+            break;
+        }
+        size_t produced = sizeof(out_buf) - avail_out;
+        if (produced && fwrite(out_buf, 1, produced, out) != produced) ok = false;
+        if (BrotliEncoderIsFinished(enc)) break;
+    }
+    BrotliEncoderDestroyInstance(enc);
+    return fclose(out) == 0 && ok;
+}
+#endif
+
+// Compresses `path` into `sidecar`. The sidecar gets the source's mtime, so
+// it counts as fresh until the source is modified again, and is dropped if
+// it would not be smaller than the source.
+static void buildSidecar(const std::string& path, const struct stat& source, const std::string& encoding) {
+    std::string sidecar = path + Precompressor::extensionFor(encoding);
+    if (isFresh(sidecar, source)) return;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    std::string tmp = sidecar + ".tmp";
+    bool ok = false;
+    if (encoding == "gzip") ok = writeGzip(fd, tmp);
+#ifdef WEBSERV_BROTLI
+    else if (encoding == "br") ok = writeBrotli(fd, tmp);
+#endif
+    close(fd);
+
+    struct stat st;
+    if (!ok || stat(tmp.c_str(), &st) != 0 || st.st_size >= source.st_size) {
+        unlink(tmp.c_str());
+        return;
+    }
+    struct timeval times[2];
+    times[0].tv_sec = source.st_mtime;
+    times[0].tv_usec = 0;
+    times[1] = times[0];
+    utimes(tmp.c_str(), times);
+    if (rename(tmp.c_str(), sidecar.c_str()) != 0) unlink(tmp.c_str());
+}
+
+static void* worker(void* arg) {
+    PrecompressJob* job = static_cast<PrecompressJob*>(arg);
+    while (true) {
+        pthread_mutex_lock(&job->lock);
+        if (job->next >= job->files.size()) {
+            pthread_mutex_unlock(&job->lock);
+            return NULL;
+        }
+        std::string path = job->files[job->next++];
+        pthread_mutex_unlock(&job->lock);
+
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        buildSidecar(path, st, "gzip");
+#ifdef WEBSERV_BROTLI
+        buildSidecar(path, st, "br");
+#endif
+    }
+}
+
+std::string Precompressor::extensionFor(const std::string& encoding) {
+    if (encoding == "gzip") return ".gz";
+    if (encoding == "br") return ".br";
+    return "";
+}
+
+bool Precompressor::isCompressible(const std::string& path) {
+    std::string type = getMimeType(path);
+    return type.compare(0, 5, "text/") == 0 || type == "application/javascript"
+        || type == "application/json" || type == "image/svg+xml" || type == "image/x-icon";
+}
+
+void Precompressor::start(const std::vector<std::string>& roots, int threads) {
+    // Shared by the detached workers for the life of the process.
+    PrecompressJob* job = new PrecompressJob;
+    job->next = 0;
+    pthread_mutex_init(&job->lock, NULL);
+    for (size_t i = 0; i < roots.size(); ++i) collect(roots[i], job->files);
+    // Nested locations can list a file twice; two threads must never write
+    // the same temporary file.
+    std::sort(job->files.begin(), job->files.end());
+    job->files.erase(std::unique(job->files.begin(), job->files.end()), job->files.end());
+    if (job->files.empty()) {
+        pthread_mutex_destroy(&job->lock);
+        delete job;
+        return;
+    }
+
+    std::cout << "Precompressing " << job->files.size() << " files with " << threads << " threads" << std::endl;
+    for (int i = 0; i < threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, job) != 0) {
+            std::cerr << "Could not start precompression thread" << std::endl;
+            break;
+        }
+        pthread_detach(thread);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef PRECOMPRESSOR_HPP
+#define PRECOMPRESSOR_HPP
+
+#include <string>
+#include <vector>
+
+// Builds the .gz (and, when compiled with brotli, .br) sidecars served by
+// gzip_static locations. Runs in detached background threads so startup is
+// not held up; each sidecar is written to a temporary name and renamed into
+// place, so a half-written one is never served.
+class Precompressor {
+public:
+    // Walks `roots` and queues every compressible file whose sidecars are
+    // missing or older than the file, then returns right away.
+    static void start(const std::vector<std::string>& roots, int threads);
+
+    // Sidecar suffix for a Content-Encoding token ("gzip" -> ".gz").
+    static std::string extensionFor(const std::string& encoding);
+    static bool isCompressible(const std::string& path);
+
+private:
+    Precompressor();
+};
+
+#endif // PRECOMPRESSOR_HPP
@@ -0,0 +1,213 @@
+#include "PutUpload.hpp"
+
+#include <sys/socket.h> // For recv
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio> // For rename
+#include <cstdlib> // For strtoul
+#include <cstring> // For memchr
+#include <algorithm> // For std::min
+#include <vector>
+
+// Bytes moved per splice() round trip through the pipe (its default size).
+static const size_t k_splice_chunk = 64 * 1024;
+// Longest chunk-size or trailer line accepted.
+static const size_t k_max_framing_line = 1024;
+
+PutUpload::PutUpload() :
+    _fd(-1),
+    _offset(0),
+    _remaining(0),
+    _received(0),
+    _limit(0),
+    _expected(0),
+    _chunk(CHUNK_NONE),
+    _created(false),
+    _status(RECEIVING)
+{
+    _pipe[0] = -1;
+    _pipe[1] = -1;
+}
+
+PutUpload::~PutUpload() {
+    if (_fd >= 0) close(_fd);
+    if (_pipe[0] >= 0) close(_pipe[0]);
+    if (_pipe[1] >= 0) close(_pipe[1]);
+    if (!_temp.empty()) unlink(_temp.c_str());
+}
+
+bool PutUpload::open(const std::string& path, bool chunked, size_t length, off_t offset, bool in_place, size_t limit) {
+    _path = path;
+    _offset = offset;
+    _limit = limit;
+    _chunk = chunked ? CHUNK_SIZE : CHUNK_NONE;
+    _remaining = chunked ? 0 : length;
+    _expected = chunked ? length : 0;
+
+    struct stat st;
+    _created = stat(path.c_str(), &st) != 0;
+    if (in_place) {
+        _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    } else {
+        std::string temp = path.substr(0, path.find_last_of('/') + 1) + ".upload-XXXXXX";
+        std::vector<char> name(temp.begin(), temp.end());
+        name.push_back('\0');
+        _fd = mkstemp(&name[0]);
+        if (_fd >= 0) {
+            _temp = &name[0];
+            fcntl(_fd, F_SETFD, FD_CLOEXEC);
+            fchmod(_fd, 0644);
+        }
+    }
+    if (_fd < 0) return false;
+
+#ifdef __linux__
+    if (pipe(_pipe) != 0) return false;
+    for (int i = 0; i < 2; ++i) {
+        fcntl(_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    if (!chunked && length == 0) _status = DONE;
+    return true;
+}
+
+size_t PutUpload::consume(const char* data, size_t len) {
+    size_t pos = 0;
+    while (pos < len && _status == RECEIVING) {
+        if (_chunk == CHUNK_NONE || _chunk == CHUNK_DATA) {
+            size_t n = _writeData(data + pos, std::min(len - pos, _remaining));
+            pos += n;
+            _dataDone(n);
+            continue;
+        }
+        const char* lf = static_cast<const char*>(std::memchr(data + pos, '\n', len - pos));
+        size_t take = lf ? static_cast<size_t>(lf - (data + pos)) + 1 : len - pos;
+        _line.append(data + pos, take);
+        pos += take;
+        if (_line.size() > k_max_framing_line) {
+            _status = MALFORMED;
+        } else if (lf) {
+            std::string line;
+            line.swap(_line);
+            _framingLine(line);
+        }
+    }
+    return pos;
+}
+
+ssize_t PutUpload::receive(int sock) {
+    if (_chunk == CHUNK_NONE || _chunk == CHUNK_DATA) {
+#ifdef __linux__
+        ssize_t in = splice(sock, NULL, _pipe[1], NULL, std::min(_remaining, k_splice_chunk),
+                            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (in <= 0) return in;
+        for (size_t left = in; left > 0; ) {
+            loff_t off = _offset;
+            ssize_t out = splice(_pipe[0], NULL, _fd, &off, left, SPLICE_F_MOVE);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                _status = FAILED;
+                return in;
+            }
+            _offset += out;
+            left -= out;
+        }
+        _dataDone(in);
+        return in;
+#else
+        char buffer[k_splice_chunk];
+        ssize_t in = recv(sock, buffer, std::min(_remaining, sizeof(buffer)), 0);
+        if (in <= 0) return in;
+        _dataDone(_writeData(buffer, in));
+        return in;
+#endif
+    }
+
+    // Framing: look for the end of the line, then take exactly that much so
+    // the chunk data behind it stays in the socket for splice().
+    char buffer[128];
+    ssize_t n = recv(sock, buffer, sizeof(buffer), MSG_PEEK);
+    if (n <= 0) return n;
+    const char* lf = static_cast<const char*>(std::memchr(buffer, '\n', n));
+    n = recv(sock, buffer, lf ? lf - buffer + 1 : n, 0);
+    if (n <= 0) return n;
+    consume(buffer, n);
+    return n;
+}
+
+bool PutUpload::commit() {
+    if (_status != DONE) return false;
+    bool ok = close(_fd) == 0;
+    _fd = -1;
+    if (ok && !_temp.empty()) {
+        ok = std::rename(_temp.c_str(), _path.c_str()) == 0;
+        if (ok) _temp.clear();
+    }
+    return ok;
+}
+
+PutUpload::Status PutUpload::status() const {
+    return _status;
+}
+
+bool PutUpload::created() const {
+    return _created;
+}
+
+off_t PutUpload::storedSize() const {
+    struct stat st;
+    return stat(_path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// Writes at the current offset. Returns the bytes written, all of them
+// unless the write failed.
+size_t PutUpload::_writeData(const char* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t written = pwrite(_fd, data + done, len - done, _offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            _status = FAILED;
+            break;
+        }
+        done += written;
+        _offset += written;
+    }
+    return done;
+}
+
+void PutUpload::_framingLine(const std::string& raw) {
+    std::string line = raw.substr(0, raw.find_first_of("\r\n"));
+    if (_chunk == CHUNK_SIZE) {
+        char* end;
+        unsigned long size = std::strtoul(line.c_str(), &end, 16);
+        if (end == line.c_str() || (*end != '\0' && *end != ';')) {
+            _status = MALFORMED;
+        } else if (size == 0) {
+            _chunk = CHUNK_TRAILER;
+        } else if (size > _limit - std::min(_received, _limit)) {
+            _status = TOO_LARGE;
+        } else {
+            _remaining = size;
+            _chunk = CHUNK_DATA;
+        }
+    } else if (_chunk == CHUNK_DATA_END) {
+        if (line.empty()) _chunk = CHUNK_SIZE;
+        else _status = MALFORMED;
+    } else if (_chunk == CHUNK_TRAILER && line.empty()) {
+        // Trailer fields are ignored
+        _status = _expected == 0 || _received == _expected ? DONE : MALFORMED;
+    }
+}
+
+void PutUpload::_dataDone(size_t len) {
+    _received += len;
+    _remaining -= len;
+    if (_remaining == 0 && _status == RECEIVING) {
+        if (_chunk == CHUNK_NONE) _status = DONE;
+        else _chunk = CHUNK_DATA_END;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef PUT_UPLOAD_HPP
+#define PUT_UPLOAD_HPP
+
+#include <sys/types.h>
+#include <string>
+
+// Body of a PUT, moved from the client socket into the destination file.
+// On Linux the payload goes socket -> pipe -> file with splice(), so it
+// never enters user space; only chunk-size lines are read, byte-exact, to
+// decode a chunked body. Bytes that were already read along with the head
+// are written with pwrite() first.
+// A whole-file PUT is written to a temp file next to the destination and
+// renamed over it by commit(); a ranged PUT (Content-Range) writes in
+// place at its offset, so an interrupted upload can be resumed.
+class PutUpload {
+public:
+    enum Status {
+        RECEIVING,
+        DONE,
+        TOO_LARGE, // Chunked body grew past the limit
+        MALFORMED, // Bad chunk framing, or a chunked body shorter than expected
+        FAILED     // Write error
+    };
+
+    PutUpload();
+    ~PutUpload(); // Removes the temp file unless committed
+
+    // `length` is the Content-Length, or for a chunked body the exact size
+    // it must decode to (0 if any size up to `limit` will do). `offset` is
+    // where the body starts in the file; `in_place` skips the temp file.
+    bool open(const std::string& path, bool chunked, size_t length, off_t offset, bool in_place, size_t limit);
+    // Takes body bytes already read from the socket; returns how many
+    // belonged to the body.
+    size_t consume(const char* data, size_t len);
+    // Moves the next bytes straight from the socket. Returns the bytes
+    // taken, 0 if the peer closed, -1 on error (errno, EAGAIN included).
+    ssize_t receive(int sock);
+    bool commit();
+
+    Status status() const;
+    bool created() const;      // The destination did not exist before
+    off_t storedSize() const;  // Size of the destination after commit()
+
+private:
+    PutUpload(const PutUpload&);
+    PutUpload& operator=(const PutUpload&);
+
+    enum ChunkState {
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        CHUNK_DATA_END, // CRLF after the chunk data
+        CHUNK_TRAILER,
+        CHUNK_NONE      // Content-Length body
+    };
+
+    size_t _writeData(const char* data, size_t len);
+    void _framingLine(const std::string& line);
+    void _dataDone(size_t len);
+
+    std::string _path;
+    std::string _temp;
+    int _fd;
+    int _pipe[2];
+    off_t _offset;     // Next file offset to write
+    size_t _remaining; // Of the Content-Length body or the current chunk
+    size_t _received;
+    size_t _limit;
+    size_t _expected;  // Exact decoded size of a chunked body, 0 if any
+    ChunkState _chunk;
+    std::string _line; // Framing line split across reads
+    bool _created;
+    Status _status;
+};
+
+#endif // PUT_UPLOAD_HPP
@@ -0,0 +1,83 @@
+#include "ResponseCompressor.hpp"
+#include <zlib.h>
+#include <cstring>
+#include <sstream>
+
+ResponseCompressor::ResponseCompressor(size_t max_bytes) :
+    _max_bytes(max_bytes),
+    _bytes(0),
+    _hits(0),
+    _misses(0),
+    _evictions(0)
+{}
+
+ResponseCompressor::~ResponseCompressor() {}
+
+// Two independent hashes (FNV-1a and CRC-32) plus the length, so a
+// collision would have to defeat both at once.
+std::string ResponseCompressor::_key(const std::string& body, const std::string& encoding, int level) {
+    unsigned long long fnv = 1469598103934665603ULL;
+    for (size_t i = 0; i < body.size(); ++i) {
+        fnv ^= static_cast<unsigned char>(body[i]);
+        fnv *= 1099511628211ULL;
+    }
+    unsigned long crc = crc32(0L, reinterpret_cast<const Bytef*>(body.data()), static_cast<uInt>(body.size()));
+
+    std::stringstream ss;
+    ss << std::hex << fnv << ":" << crc << ":" << body.size() << ":" << encoding << ":" << level;
+    return ss.str();
+}
+
+bool ResponseCompressor::compress(const std::string& body, const std::string& encoding, int level, std::string& out) {
+    std::string key = _key(body, encoding, level);
+    EntryIndex::iterator it = _index.find(key);
+    if (it != _index.end()) {
+        _lru.splice(_lru.begin(), _lru, it->second);
+        out = it->second->data;
+        ++_hits;
+        return true;
+    }
+    ++_misses;
+
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    // 15 window bits give the zlib format of "deflate"; +16 wraps it as gzip.
+    int window_bits = (encoding == "gzip") ? 15 + 16 : 15;
+    if (deflateInit2(&zs, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+    out.resize(deflateBound(&zs, static_cast<uLong>(body.size())));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+    zs.avail_in = static_cast<uInt>(body.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs.avail_out = static_cast<uInt>(out.size());
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    if (ret != Z_STREAM_END) return false;
+
+    _store(key, out);
+    return true;
+}
+
+void ResponseCompressor::_store(const std::string& key, const std::string& data) {
+    size_t cost = key.size() + data.size();
+    if (cost > _max_bytes) return;
+    while (_bytes + cost > _max_bytes && !_lru.empty()) {
+        _bytes -= _lru.back().key.size() + _lru.back().data.size();
+        _index.erase(_lru.back().key);
+        _lru.pop_back();
+        ++_evictions;
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.data = data;
+    _lru.push_front(entry);
+    _index[key] = _lru.begin();
+    _bytes += cost;
+}
+
+unsigned long ResponseCompressor::getHits() const { return _hits; }
+unsigned long ResponseCompressor::getMisses() const { return _misses; }
+unsigned long ResponseCompressor::getEvictions() const { return _evictions; }
+size_t ResponseCompressor::getBytes() const { return _bytes; }
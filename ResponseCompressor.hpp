@@ -0,0 +1,49 @@
+#ifndef RESPONSE_COMPRESSOR_HPP
+#define RESPONSE_COMPRESSOR_HPP
+
+#include <list>
+#include <map>
+#include <string>
+
+// gzip/deflate compression of generated bodies (CGI output, autoindex
+// pages). Results are kept in a byte-budgeted LRU keyed by a hash of the
+// content, encoding and level, so a response that comes out identical
+// again is not recompressed.
+class ResponseCompressor {
+public:
+    ResponseCompressor(size_t max_bytes);
+    ~ResponseCompressor();
+
+    // Compresses `body` with "gzip" or "deflate" at `level` (1-9) into
+    // `out`. Returns false if zlib fails.
+    bool compress(const std::string& body, const std::string& encoding, int level, std::string& out);
+
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+    unsigned long getEvictions() const;
+    size_t getBytes() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::string data;
+    };
+    typedef std::list<Entry> EntryList;
+    typedef std::map<std::string, EntryList::iterator> EntryIndex;
+
+    ResponseCompressor(const ResponseCompressor&);
+    ResponseCompressor& operator=(const ResponseCompressor&);
+
+    static std::string _key(const std::string& body, const std::string& encoding, int level);
+    void _store(const std::string& key, const std::string& data);
+
+    size_t _max_bytes;
+    size_t _bytes;
+    EntryList _lru; // Most recently used first
+    EntryIndex _index;
+    unsigned long _hits;
+    unsigned long _misses;
+    unsigned long _evictions;
+};
+
+#endif // RESPONSE_COMPRESSOR_HPP
@@ -0,0 +1,71 @@
+#include "SelectPoller.hpp"
+#include <sys/time.h>
+
+SelectPoller::SelectPoller() : _max_fd(-1) {
+    FD_ZERO(&_read_set);
+    FD_ZERO(&_write_set);
+}
+
+SelectPoller::~SelectPoller() {}
+
+const char* SelectPoller::name() const {
+    return "select";
+}
+
+bool SelectPoller::add(int fd, int events) {
+    if (fd < 0 || fd >= FD_SETSIZE) return false;
+    _apply(fd, events);
+    if (fd > _max_fd) _max_fd = fd;
+    return true;
+}
+
+void SelectPoller::modify(int fd, int events) {
+    if (fd < 0 || fd >= FD_SETSIZE) return;
+    _apply(fd, events);
+}
+
+void SelectPoller::remove(int fd) {
+    if (fd < 0 || fd >= FD_SETSIZE) return;
+    _apply(fd, 0);
+    while (_max_fd >= 0 && getInterest(_max_fd) == 0) {
+        --_max_fd;
+    }
+}
+
+void SelectPoller::_apply(int fd, int events) {
+    if (events & EVENT_READ) FD_SET(fd, &_read_set);
+    else FD_CLR(fd, &_read_set);
+    if (events & EVENT_WRITE) FD_SET(fd, &_write_set);
+    else FD_CLR(fd, &_write_set);
+    _setInterest(fd, events);
+}
+
+int SelectPoller::wait(std::vector<Event>& ready, int timeout_ms) {
+    ready.clear();
+    fd_set read_fds = _read_set;
+    fd_set write_fds = _write_set;
+
+    struct timeval tv;
+    struct timeval* tv_ptr = NULL;
+    if (timeout_ms >= 0) {
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        tv_ptr = &tv;
+    }
+
+    int n = select(_max_fd + 1, &read_fds, &write_fds, NULL, tv_ptr);
+    if (n <= 0) return n;
+
+    for (int fd = 0; fd <= _max_fd && static_cast<int>(ready.size()) < n; ++fd) {
+        int events = 0;
+        if (FD_ISSET(fd, &read_fds)) events |= EVENT_READ;
+        if (FD_ISSET(fd, &write_fds)) events |= EVENT_WRITE;
+        if (events) {
+            Event ev;
+            ev.fd = fd;
+            ev.events = events;
+            ready.push_back(ev);
+        }
+    }
+    return static_cast<int>(ready.size());
+}
@@ -0,0 +1,28 @@
+#ifndef SELECT_POLLER_HPP
+#define SELECT_POLLER_HPP
+
+#include <sys/select.h>
+#include "Poller.hpp"
+
+// Portable fallback backend. Limited to FD_SETSIZE descriptors and costs
+// O(max_fd) per wakeup, so it is only meant for platforms without epoll.
+class SelectPoller : public Poller {
+public:
+    SelectPoller();
+    virtual ~SelectPoller();
+
+    virtual const char* name() const;
+    virtual bool add(int fd, int events);
+    virtual void modify(int fd, int events);
+    virtual void remove(int fd);
+    virtual int wait(std::vector<Event>& ready, int timeout_ms);
+
+private:
+    void _apply(int fd, int events);
+
+    fd_set _read_set;
+    fd_set _write_set;
+    int _max_fd;
+};
+
+#endif // SELECT_POLLER_HPP
@@ -1,6 +1,9 @@
 #include "Server.hpp"
 #include "HttpRequest.hpp"
 #include "HttpResponse.hpp"
+#include "Precompressor.hpp"
+#include "ByteScan.hpp"
+#include "HttpRequestParser.hpp"
 #include <stdexcept>
 #include <sstream>
 #include <fstream>
@@ -13,10 +16,12 @@
 #include <unistd.h>
 #include <cstdio> // For std::remove
 #include <cstring>
+#include <strings.h> // For strcasecmp
 #include <cstdlib>
+#include <cctype>
 #include <sys/wait.h>
 #include <signal.h>
-#include <dirent.h>
+#include <ctime>
 #include <sys/stat.h>
 
 std::string getMimeType(const std::string& filePath) {
@@ -49,20 +54,424 @@ std::string getMimeType(const std::string& filePath) {
     return "application/octet-stream";
 }
 
-Server::Server(const ConfigParser& config) : _config(config), _max_fd(0) {
-    FD_ZERO(&_master_set);
-    FD_ZERO(&_write_fds);
+static std::string httpDate(time_t t) {
+    char buf[64];
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
 
-    const std::vector<int>& ports = _config.getPorts();
-    if (ports.empty()) {
+// Validators of a file as it was when opened or cached.
+struct Validators {
+    std::string etag;
+    std::string last_modified;
+    time_t mtime;
+};
+
+static Validators validatorsFor(ino_t ino, off_t size, time_t mtime) {
+    Validators v;
+    std::stringstream ss;
+    ss << std::hex << "\"" << ino << "-" << size << "-" << mtime << "\"";
+    v.etag = ss.str();
+    v.last_modified = httpDate(mtime);
+    v.mtime = mtime;
+    return v;
+}
+
+static void addValidators(HttpResponse& res, const Validators& v) {
+    res.addHeader("ETag", v.etag);
+    res.addHeader("Last-Modified", v.last_modified);
+}
+
+// Header block for a whole file. A non-empty encoding means `st` describes
+// the precompressed sidecar of `path`.
+static std::string fileHeaders(const std::string& path, const struct stat& st, const std::string& encoding = "") {
+    HttpResponse res;
+    res.setStatusCode(200, "OK");
+    res.addHeader("Content-Type", getMimeType(path));
+    if (!encoding.empty()) res.addHeader("Content-Encoding", encoding);
+    res.addHeader("Accept-Ranges", "bytes");
+    addValidators(res, validatorsFor(st.st_ino, st.st_size, st.st_mtime));
+    std::stringstream ss_len; ss_len << st.st_size;
+    res.addHeader("Content-Length", ss_len.str());
+    return res.headersToString();
+}
+
+// Adds raw header lines to a serialized header block, before its blank line.
+static std::string insertHeaders(const std::string& block, const std::string& lines) {
+    if (lines.empty()) return block;
+    return block.substr(0, block.length() - 2) + lines + "\r\n";
+}
+
+// Expires and Cache-Control lines for the location, as raw header lines.
+// They depend on the time of the response, so they are never cached.
+static std::string cachingHeaders(const LocationConfig* loc) {
+    if (!loc) return "";
+    std::string lines;
+    if (loc->gzip_static) lines += "Vary: Accept-Encoding\r\n";
+    if (loc->expires >= 0) {
+        lines += "Expires: " + httpDate(time(NULL) + loc->expires) + "\r\n";
+        if (loc->cache_control.empty()) {
+            std::stringstream ss; ss << loc->expires;
+            lines += "Cache-Control: max-age=" + ss.str() + "\r\n";
+        }
+    }
+    if (!loc->cache_control.empty()) lines += "Cache-Control: " + loc->cache_control + "\r\n";
+    return lines;
+}
+
+// The codings out of `preferred` that the client accepts, in that order. A
+// coding is acceptable when it is listed, or covered by "*", without q=0.
+static std::vector<std::string> acceptedEncodings(const std::string& header, const char* const preferred[], size_t count) {
+    std::vector<std::string> accepted;
+    if (header.empty()) return accepted;
+
+    std::map<std::string, bool> listed;
+    std::stringstream ss(header);
+    std::string token;
+    while (std::getline(ss, token, ',')) {
+        std::string coding = token.substr(0, token.find(';'));
+        size_t start = coding.find_first_not_of(" \t");
+        if (start == std::string::npos) continue;
+        coding = coding.substr(start, coding.find_last_not_of(" \t") - start + 1);
+        for (size_t i = 0; i < coding.length(); ++i) coding[i] = std::tolower(coding[i]);
+
+        bool allowed = true;
+        size_t q = token.find("q=");
+        if (q != std::string::npos) allowed = std::strtod(token.c_str() + q + 2, NULL) > 0;
+        listed[coding] = allowed;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        std::map<std::string, bool>::const_iterator it = listed.find(preferred[i]);
+        if (it == listed.end()) it = listed.find("*");
+        if (it != listed.end() && it->second) accepted.push_back(preferred[i]);
+    }
+    return accepted;
+}
+
+static const char* const k_sidecar_encodings[] = { "br", "gzip" };
+static const char* const k_dynamic_encodings[] = { "gzip", "deflate" };
+
+static bool etagListMatches(const std::string& list, const std::string& etag) {
+    std::stringstream ss(list);
+    std::string tag;
+    while (std::getline(ss, tag, ',')) {
+        size_t start = tag.find_first_not_of(" \t");
+        if (start == std::string::npos) continue;
+        tag = tag.substr(start, tag.find_last_not_of(" \t") - start + 1);
+        if (tag == "*") return true;
+        if (tag.compare(0, 2, "W/") == 0) tag = tag.substr(2); // Weak comparison
+        if (tag == etag) return true;
+    }
+    return false;
+}
+
+static bool parseHttpDate(const std::string& str, time_t& out) {
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end) return false;
+    out = timegm(&tm);
+    return true;
+}
+
+// If-None-Match wins over If-Modified-Since, as in RFC 9110.
+static bool isNotModified(const HttpRequest& req, const Validators& v) {
+    const std::string& if_none_match = req.getHeader("If-None-Match");
+    if (!if_none_match.empty()) return etagListMatches(if_none_match, v.etag);
+
+    time_t since;
+    const std::string& if_modified_since = req.getHeader("If-Modified-Since");
+    return !if_modified_since.empty() && parseHttpDate(if_modified_since, since) && v.mtime <= since;
+}
+
+// If-Range keeps the Range only while the file is unchanged: a strong ETag
+// or the exact Last-Modified date.
+static bool ifRangeMatches(const HttpRequest& req, const Validators& v) {
+    const std::string& if_range = req.getHeader("If-Range");
+    if (if_range.empty()) return true;
+    if (if_range[0] == '"') return if_range == v.etag;
+    return if_range == v.last_modified;
+}
+
+static void queueNotModified(ClientConnection* client, const Validators& v, const std::string& caching) {
+    HttpResponse res;
+    res.setStatusCode(304, "Not Modified");
+    addValidators(res, v);
+    client->setResponse(insertHeaders(res.headersToString(), caching));
+}
+
+static bool readFile(int fd, size_t size, std::string& out) {
+    out.resize(size);
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, &out[done], size - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+enum RangeResult {
+    RANGE_IGNORE,        // No usable Range header: serve the whole file
+    RANGE_SATISFIABLE,
+    RANGE_UNSATISFIABLE
+};
+
+typedef std::vector<std::pair<off_t, off_t> > ByteRanges; // Inclusive first/last
+
+// More ranges than this in one request are ignored rather than served.
+static const size_t k_max_ranges = 16;
+
+static bool parseOffset(const std::string& str, off_t& out) {
+    if (str.empty() || str.size() > 18) return false;
+    out = 0;
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] < '0' || str[i] > '9') return false;
+        out = out * 10 + (str[i] - '0');
+    }
+    return true;
+}
+
+// Parses a "bytes=" Range header against a file of `size` bytes. Malformed
+// headers, other units and too many ranges are ignored; specs starting past
+// the end are dropped, and if none is left the request is unsatisfiable.
+static RangeResult parseRanges(const std::string& header, off_t size, ByteRanges& ranges) {
+    const std::string unit = "bytes=";
+    if (header.compare(0, unit.size(), unit) != 0) return RANGE_IGNORE;
+
+    std::stringstream ss(header.substr(unit.size()));
+    std::string spec;
+    size_t count = 0;
+    while (std::getline(ss, spec, ',')) {
+        size_t start = spec.find_first_not_of(" \t");
+        if (start == std::string::npos) continue;
+        spec = spec.substr(start, spec.find_last_not_of(" \t") - start + 1);
+        if (++count > k_max_ranges) return RANGE_IGNORE;
+
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos) return RANGE_IGNORE;
+        std::string first_str = spec.substr(0, dash);
+        std::string last_str = spec.substr(dash + 1);
+        off_t first, last;
+        if (first_str.empty()) { // "-N": the last N bytes
+            off_t suffix;
+            if (!parseOffset(last_str, suffix)) return RANGE_IGNORE;
+            if (suffix == 0 || size == 0) continue;
+            first = suffix >= size ? 0 : size - suffix;
+            last = size - 1;
+        } else {
+            if (!parseOffset(first_str, first)) return RANGE_IGNORE;
+            last = size - 1;
+            if (!last_str.empty()) {
+                if (!parseOffset(last_str, last) || last < first) return RANGE_IGNORE;
+                if (last >= size) last = size - 1;
+            }
+            if (first >= size) continue;
+        }
+        ranges.push_back(std::make_pair(first, last));
+    }
+    if (count == 0) return RANGE_IGNORE;
+    return ranges.empty() ? RANGE_UNSATISFIABLE : RANGE_SATISFIABLE;
+}
+
+static std::string contentRange(off_t first, off_t last, off_t size) {
+    std::stringstream ss;
+    ss << "bytes " << first << "-" << last << "/" << size;
+    return ss.str();
+}
+
+// Queues a 206 for the given ranges of an open file. One range is sent as
+// a plain body, several as multipart/byteranges; either way the bytes are
+// streamed from the file, whose hold the connection takes over.
+static void queueRanges(ClientConnection* client, const std::string& path, OpenFileCache::File* file,
+                        const ByteRanges& ranges, const std::string& caching) {
+    const struct stat& st = file->st;
+    off_t size = st.st_size;
+    HttpResponse res;
+    res.setStatusCode(206, "Partial Content");
+    res.addHeader("Accept-Ranges", "bytes");
+    addValidators(res, validatorsFor(st.st_ino, st.st_size, st.st_mtime));
+
+    if (ranges.size() == 1) {
+        off_t length = ranges[0].second - ranges[0].first + 1;
+        res.addHeader("Content-Type", getMimeType(path));
+        res.addHeader("Content-Range", contentRange(ranges[0].first, ranges[0].second, size));
+        std::stringstream ss_len; ss_len << length;
+        res.addHeader("Content-Length", ss_len.str());
+        client->setResponse(insertHeaders(res.headersToString(), caching));
+        client->setFileBody(file, ranges[0].first, static_cast<size_t>(length));
+        return;
+    }
+
+    static unsigned long sequence = 0;
+    std::stringstream boundary_ss;
+    boundary_ss << "webserv" << getpid() << "x" << ++sequence;
+    std::string boundary = boundary_ss.str();
+
+    client->setFileBody(file, 0, 0);
+    off_t total = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        std::string part = "\r\n--" + boundary + "\r\nContent-Type: " + getMimeType(path)
+            + "\r\nContent-Range: " + contentRange(ranges[i].first, ranges[i].second, size) + "\r\n\r\n";
+        off_t length = ranges[i].second - ranges[i].first + 1;
+        client->addFileSegment(part, ranges[i].first, static_cast<size_t>(length));
+        total += static_cast<off_t>(part.size()) + length;
+    }
+    std::string closing = "\r\n--" + boundary + "--\r\n";
+    client->addFileSegment(closing, 0, 0);
+    total += closing.size();
+
+    res.addHeader("Content-Type", "multipart/byteranges; boundary=" + boundary);
+    std::stringstream ss_len; ss_len << total;
+    res.addHeader("Content-Length", ss_len.str());
+    client->setResponse(insertHeaders(res.headersToString(), caching));
+}
+
+static void queueRangeNotSatisfiable(ClientConnection* client, off_t size) {
+    HttpResponse res;
+    res.setStatusCode(416, "Range Not Satisfiable");
+    std::stringstream range_ss; range_ss << "bytes */" << size;
+    res.addHeader("Content-Range", range_ss.str());
+    res.addHeader("Content-Type", "text/html");
+    std::string body = "<html><body><h1>416 Range Not Satisfiable</h1></body></html>";
+    std::stringstream ss_len; ss_len << body.length();
+    res.addHeader("Content-Length", ss_len.str());
+    res.setBody(body);
+    client->setResponse(res.toString());
+}
+
+// Directory entries scanned or rendered per listing per loop iteration.
+static const size_t k_autoindex_batch = 512;
+
+// PUT body bytes moved per wakeup, so one fast upload cannot starve the
+// other connections.
+static const size_t k_put_batch = 1024 * 1024;
+
+// Longest wait, in seconds, before a worker slot whose fork() failed or
+// whose worker died right away is tried again; the wait doubles up to it.
+static const int k_respawn_backoff_max = 32;
+
+// How long listeners stay paused after accept() ran out of descriptors
+// when no connection closed in the meantime.
+static const unsigned long k_accept_retry_ms = 1000;
+
+// Unparsed input a connection may buffer while its response is pending;
+// past this, reading pauses and the rest waits in the socket.
+static const size_t k_pipeline_buffer = 64 * 1024;
+
+static volatile sig_atomic_t g_master_stop = 0;
+static volatile sig_atomic_t g_master_reload = 0;
+// SIGHUP in a process running the event loop: rebuild what was prebuilt
+// from the configuration and the files it names (the error replies).
+static volatile sig_atomic_t g_reload = 0;
+
+// Sent verbatim to connections shed under overload: no ClientConnection,
+// parser or HttpResponse is ever built for them.
+static const char k_overload_response[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Retry-After: 5\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 58\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "<html><body><h1>503 Service Unavailable</h1></body></html>";
+
+// A shed connection is kept this long to drain its request before the
+// close, with at most k_linger_max of them at a time.
+static const unsigned long k_linger_ms = 1000;
+static const size_t k_linger_max = 256;
+
+// Interim reply to "Expect: 100-continue" once the head was accepted.
+static const char k_continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+static void masterSignalHandler(int sig) {
+    if (sig == SIGHUP) {
+        g_master_reload = 1;
+    } else if (sig != SIGALRM) { // SIGALRM only wakes the master for a respawn
+        g_master_stop = 1;
+    }
+}
+
+static void reloadSignalHandler(int) {
+    g_reload = 1;
+}
+
+// Handlers indexed by FdType: an event costs one table index plus one call.
+const Server::FdHandler Server::_readHandlers[Server::FD_TYPE_COUNT] = {
+    NULL,                           // FD_NONE
+    &Server::_acceptNewConnection,  // FD_LISTEN
+    &Server::_handleClientData,     // FD_CLIENT
+    &Server::_handleCgiRead,        // FD_CGI_STDOUT
+    NULL,                           // FD_CGI_STDIN
+    &Server::_handleInotify,        // FD_INOTIFY
+    &Server::_handleLingerRead      // FD_LINGER
+};
+
+const Server::FdHandler Server::_writeHandlers[Server::FD_TYPE_COUNT] = {
+    NULL,                           // FD_NONE
+    NULL,                           // FD_LISTEN
+    &Server::_handleClientWrite,    // FD_CLIENT
+    NULL,                           // FD_CGI_STDOUT
+    &Server::_handleCgiWrite,       // FD_CGI_STDIN
+    NULL,                           // FD_INOTIFY
+    NULL                            // FD_LINGER
+};
+
+Server::Server(const ConfigParser& config) : _config(config), _poller(NULL),
+    _file_cache(config.getFileCacheSize(), config.getFileCacheMaxFile(), config.getFileCacheValid()),
+    _compressor(config.getGzipCacheSize()),
+    _autoindex(config.getAutoindexCacheDirs()),
+    _paths(config.getPathCacheSize(), config.getPathCacheValid()),
+    _open_files(config.getOpenFileCacheMax(), config.getOpenFileCacheInactive(), config.getOpenFileCacheValid()),
+    _error_pages(config),
+    _client_count(0),
+    _accept_paused_at(0) {
+    if (_config.getPorts().empty()) {
         throw std::runtime_error("No ports specified in configuration.");
     }
+    _compilePlans();
+}
+
+// Opens the listening sockets and the event backend. With worker_processes
+// this runs inside each worker after fork(), so every worker owns its own
+// SO_REUSEPORT listener and epoll instance.
+void Server::_setupEventLoop() {
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = reloadSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGHUP, &sa, NULL);
+
+    _poller = Poller::create(_config.getEventBackend());
+    std::cout << "Using " << _poller->name() << " event backend" << std::endl;
+    const std::string& kernel = _config.getScanKernel();
+    if (!kernel.empty() && !ByteScan::select(kernel)) {
+        std::cerr << "scan_kernel " << kernel << " is not supported by this CPU" << std::endl;
+    }
+    std::cout << "Using " << ByteScan::name(ByteScan::current()) << " parser scan kernel" << std::endl;
+    HttpRequestParser::setHeadLimits(_config.getClientMaxHeaderSize(), _config.getClientMaxHeaders());
 
+    const std::vector<int>& ports = _config.getPorts();
     for (size_t i = 0; i < ports.size(); ++i) {
         int fd = _setupServerSocket(ports[i]);
         _listen_fds.push_back(fd);
-        FD_SET(fd, &_master_set);
-        if (fd > _max_fd) _max_fd = fd;
+        _setSlot(fd, FD_LISTEN, NULL);
+        if (!_poller->add(fd, Poller::EVENT_READ)) {
+            throw std::runtime_error("Could not register listening socket with the event backend");
+        }
+    }
+
+    // Per process: workers must not share one inotify queue.
+    if (_config.getPathCacheInotify()) {
+        int fd = _paths.enableInotify();
+        if (fd >= 0) {
+            _setSlot(fd, FD_INOTIFY, NULL);
+            _poller->add(fd, Poller::EVENT_READ);
+        }
     }
 }
 
@@ -70,10 +479,20 @@ Server::~Server() {
     for (size_t i = 0; i < _listen_fds.size(); ++i) {
         if (_listen_fds[i] > 0) close(_listen_fds[i]);
     }
-    for (std::map<int, ClientConnection*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        close(it->first);
-        delete it->second;
+    for (size_t fd = 0; fd < _fd_table.size(); ++fd) {
+        if (_fd_table[fd].type == FD_CLIENT) {
+            close(fd);
+            delete _fd_table[fd].owner;
+        } else if (_fd_table[fd].type == FD_CGI_STDOUT || _fd_table[fd].type == FD_CGI_STDIN
+                   || _fd_table[fd].type == FD_LINGER) {
+            close(fd);
+        }
+    }
+    for (size_t i = 0; i < _plans.size(); ++i) {
+        SharedBuffer::release(_plans[i].redirect);
+        SharedBuffer::release(_plans[i].redirect_close);
     }
+    delete _poller;
 }
 
 int Server::_setupServerSocket(int port) {
@@ -84,6 +503,19 @@ int Server::_setupServerSocket(int port) {
         close(fd);
         throw std::runtime_error("setsockopt() failed");
     }
+    if (_config.getWorkerProcesses() > 1) {
+#ifdef SO_REUSEPORT
+        // Each worker binds its own socket to the same port; the kernel
+        // spreads incoming connections across them.
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            close(fd);
+            throw std::runtime_error("setsockopt(SO_REUSEPORT) failed");
+        }
+#else
+        close(fd);
+        throw std::runtime_error("worker_processes requires SO_REUSEPORT support");
+#endif
+    }
     if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
         close(fd);
         throw std::runtime_error("fcntl() failed");
@@ -97,7 +529,7 @@ int Server::_setupServerSocket(int port) {
         close(fd);
         throw std::runtime_error("bind() failed");
     }
-    if (listen(fd, SOMAXCONN) < 0) {
+    if (listen(fd, _config.getListenBacklog()) < 0) {
         close(fd);
         throw std::runtime_error("listen() failed");
     }
@@ -106,406 +538,1343 @@ int Server::_setupServerSocket(int port) {
 }
 
 void Server::run() {
-    std::cout << "Server ready. Waiting for connections..." << std::endl;
-    while (true) {
-        fd_set read_fds = _master_set;
-        fd_set write_fds = _write_fds;
+    // A peer closing its socket (or a CGI closing its stdin) must not kill us.
+    signal(SIGPIPE, SIG_IGN);
 
-        if (select(_max_fd + 1, &read_fds, &write_fds, NULL, NULL) < 0) {
-            perror("select");
-            continue;
+    if (_config.getWorkerProcesses() > 1) {
+        _runMaster();
+        return;
+    }
+    _startPrecompression();
+    _setupEventLoop();
+    _eventLoop();
+}
+
+void Server::_runMaster() {
+    int count = _config.getWorkerProcesses();
+    std::vector<pid_t> workers(count, 0); // 0 is an empty slot
+    std::vector<time_t> started(count, 0);
+    std::vector<time_t> retry_at(count, 0); // When an empty slot is forked again
+    std::vector<int> backoff(count, 1);
+
+    // No SA_RESTART: the blocking waitpid() below must return with EINTR so
+    // the loop notices the stop request, or the alarm for a pending respawn.
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = masterSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGALRM, &sa, NULL);
+
+    std::cout << "Master " << getpid() << " starting " << count << " workers" << std::endl;
+    while (!g_master_stop) {
+        // Fill the empty slots that are due; a failed fork() is retried
+        // later with backoff rather than leaving the slot empty for good.
+        time_t now = time(NULL);
+        int next_retry = 0; // Seconds until the next empty slot is due, 0 if none
+        for (int i = 0; i < count; ++i) {
+            if (workers[i] == 0 && retry_at[i] <= now) {
+                workers[i] = _spawnWorker(i);
+                started[i] = now;
+                if (workers[i] == 0) {
+                    retry_at[i] = now + backoff[i];
+                    backoff[i] = std::min(backoff[i] * 2, k_respawn_backoff_max);
+                }
+            }
+            if (workers[i] == 0) {
+                int delay = std::max(static_cast<int>(retry_at[i] - now), 1);
+                if (next_retry == 0 || delay < next_retry) next_retry = delay;
+            }
         }
 
-        for (int fd = 0; fd <= _max_fd; ++fd) {
-            if (FD_ISSET(fd, &read_fds)) {
-                bool is_listening_fd = false;
-                for (size_t i = 0; i < _listen_fds.size(); ++i) {
-                    if (fd == _listen_fds[i]) {
-                        _acceptNewConnection(fd);
-                        is_listening_fd = true;
-                        break;
+        int status;
+        alarm(next_retry);
+        pid_t pid = waitpid(-1, &status, 0);
+        alarm(0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                if (g_master_reload) {
+                    g_master_reload = 0;
+                    for (int i = 0; i < count; ++i) {
+                        if (workers[i] > 0) kill(workers[i], SIGHUP);
                     }
                 }
-                if (is_listening_fd) continue;
-                
-                if (_pipe_to_client_map.count(fd)) {
-                    _handleCgiRead(fd);
-                } else if (_clients.count(fd)) {
-                    _handleClientData(fd);
-                }
+                continue;
             }
-            if (FD_ISSET(fd, &write_fds)) {
-                if (_cgi_stdin_pipe_to_client_map.count(fd)) {
-                    _handleCgiWrite(fd);
-                } else {
-                    _handleClientWrite(fd);
+            if (errno == ECHILD) {
+                // No worker is left at all. A slot still holding a pid lost
+                // track of it and is forked again now; if every slot is
+                // waiting out a backoff, sleep until the first is due.
+                bool due = false;
+                for (int i = 0; i < count; ++i) {
+                    if (workers[i] == 0) continue;
+                    workers[i] = 0;
+                    retry_at[i] = now;
+                    due = true;
                 }
+                if (!due) sleep(next_retry);
+                continue;
+            }
+            perror("waitpid");
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            if (workers[i] != pid) continue;
+            workers[i] = 0;
+            if (WIFSIGNALED(status)) {
+                std::cerr << "Worker " << i << " (pid " << pid << ") killed by signal " << WTERMSIG(status) << std::endl;
+            } else {
+                std::cerr << "Worker " << i << " (pid " << pid << ") exited with status " << WEXITSTATUS(status) << std::endl;
             }
+            // A worker that dies right away (e.g. bind() failing) is restarted
+            // with backoff so the master does not spin in a fork loop.
+            now = time(NULL);
+            if (now - started[i] < 1) {
+                retry_at[i] = now + backoff[i];
+                backoff[i] = std::min(backoff[i] * 2, k_respawn_backoff_max);
+            } else {
+                retry_at[i] = now;
+                backoff[i] = 1;
+            }
+            break;
         }
     }
+
+    std::cout << "Master shutting down workers" << std::endl;
+    for (int i = 0; i < count; ++i) {
+        if (workers[i] > 0) kill(workers[i], SIGTERM);
+    }
+    for (int i = 0; i < count; ++i) {
+        if (workers[i] > 0) waitpid(workers[i], NULL, 0);
+    }
 }
 
-void Server::_acceptNewConnection(int listening_fd) {
-    int client_fd = accept(listening_fd, NULL, NULL);
-    if (client_fd < 0) return;
-    
-    fcntl(client_fd, F_SETFL, O_NONBLOCK);
-    FD_SET(client_fd, &_master_set);
-    
-    if (_clients.find(client_fd) != _clients.end()) {
-        delete _clients[client_fd];
+pid_t Server::_spawnWorker(int worker_id) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork worker");
+        return 0;
+    }
+    if (pid > 0) {
+        std::cout << "Worker " << worker_id << " started with pid " << pid << std::endl;
+        return pid;
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    // The master stays single-threaded so its forks copy no held locks;
+    // one worker builds the sidecars for all of them (its CGI children
+    // only exec, see _executeCgi()).
+    if (worker_id == 0) _startPrecompression();
+    try {
+        _setupEventLoop();
+        _eventLoop();
+    } catch (const std::exception& e) {
+        std::cerr << "Worker " << worker_id << " error: " << e.what() << std::endl;
     }
-    _clients[client_fd] = new ClientConnection(client_fd);
+    exit(EXIT_FAILURE);
+}
 
-    if (client_fd > _max_fd) _max_fd = client_fd;
-    
-    std::cout << "New connection: " << client_fd << std::endl;
+void Server::_eventLoop() {
+    std::cout << "Server ready. Waiting for connections..." << std::endl;
+    std::vector<Poller::Event> events;
+    while (true) {
+        if (g_reload) {
+            g_reload = 0;
+            std::cout << "Reloading error pages" << std::endl;
+            _error_pages.build();
+        }
+        // Pending listings make the loop poll instead of sleeping.
+        int timeout = _listings.empty() ? _timers.timeoutMs(TimerWheel::nowMs()) : 0;
+        if (_accept_paused_at != 0 && (timeout < 0 || timeout > static_cast<int>(k_accept_retry_ms))) {
+            timeout = k_accept_retry_ms;
+        }
+        if (!_lingering.empty()) {
+            unsigned long now = TimerWheel::nowMs(), deadline = _lingering.front().second;
+            int wait = deadline > now ? static_cast<int>(deadline - now) : 0;
+            if (timeout < 0 || timeout > wait) timeout = wait;
+        }
+        if (_poller->wait(events, timeout) < 0) {
+            if (errno != EINTR) perror(_poller->name());
+            continue;
+        }
+
+        for (size_t e = 0; e < events.size(); ++e) {
+            int fd = events[e].fd;
+            if (events[e].events & Poller::EVENT_READ) {
+                // Copy the slot: handlers may grow the table (accept) or
+                // clear it (close) while running.
+                FdSlot slot = _slotOf(fd);
+                FdHandler handler = _readHandlers[slot.type];
+                if (handler) (this->*handler)(fd, slot.owner);
+            }
+            if (events[e].events & Poller::EVENT_WRITE) {
+                FdSlot slot = _slotOf(fd);
+                FdHandler handler = _writeHandlers[slot.type];
+                if (handler) (this->*handler)(fd, slot.owner);
+            }
+        }
+        _advanceListings();
+        _handleTimeouts();
+    }
 }
 
-void Server::_handleClientData(int client_fd) {
+// Drains the listen queue until EAGAIN, but never takes more than
+// accept_batch connections per wakeup so a connection storm cannot starve
+// clients that already have work pending. The backends are level-triggered,
+// so whatever is left in the backlog is picked up on the next iteration.
+void Server::_acceptNewConnection(int listening_fd, ClientConnection*) {
+    int budget = _config.getAcceptBatch();
+    for (int accepted = 0; accepted < budget; ++accepted) {
+#ifdef __linux__
+        int client_fd = accept4(listening_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int client_fd = accept(listening_fd, NULL, NULL);
+        if (client_fd >= 0) {
+            fcntl(client_fd, F_SETFL, O_NONBLOCK);
+            fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                // The level-triggered listener would fire again at once
+                perror("accept, pausing new connections");
+                _pauseAccept(true);
+                return;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+
+        if (_isOverloaded()) {
+            _shedConnection(client_fd);
+            continue;
+        }
+
+        if (!_poller->add(client_fd, Poller::EVENT_READ)) {
+            std::cerr << "Could not register client " << client_fd << " with the event backend" << std::endl;
+            close(client_fd);
+            continue;
+        }
+
+        ClientConnection* client = new ClientConnection(client_fd);
+        _setSlot(client_fd, FD_CLIENT, client);
+        ++_client_count;
+        _armTimer(client, ClientConnection::TIMEOUT_HEADER);
+
+        std::cout << "New connection: " << client_fd << std::endl;
+    }
+}
+
+// Past the soft watermark of max_connections, or with too many bytes
+// buffered across connections, new clients are turned away so the requests
+// already accepted stay fast.
+bool Server::_isOverloaded() const {
+    size_t max_connections = _config.getMaxConnections();
+    if (max_connections > 0) {
+        size_t soft_limit = max_connections * _config.getOverloadWatermark() / 100;
+        if (soft_limit == 0) soft_limit = 1;
+        if (_client_count >= soft_limit) return true;
+    }
+    size_t max_pending = _config.getMaxPendingBytes();
+    return max_pending > 0 && ClientConnection::getPendingBytes() >= max_pending;
+}
+
+// Stops or resumes watching the listeners. Paused ones stay registered
+// (EVENT_ERROR alone), like clients whose reads are paused. Accepting
+// resumes when a descriptor is released, or after k_accept_retry_ms.
+void Server::_pauseAccept(bool paused) {
+    if (paused == (_accept_paused_at != 0)) return;
+    _accept_paused_at = paused ? TimerWheel::nowMs() : 0;
+    for (size_t i = 0; i < _listen_fds.size(); ++i) {
+        _pauseReading(_listen_fds[i], paused);
+    }
+}
+
+// Closing with the request unread would make the kernel reset the
+// connection, which can destroy the 503 before the client reads it. So the
+// write side is shut down and the request drained until the client closes
+// or k_linger_ms passes; still without a ClientConnection.
+void Server::_shedConnection(int client_fd) {
+    // Best effort: the socket is fresh, so the send buffer has room for it.
+    send(client_fd, k_overload_response, sizeof(k_overload_response) - 1, MSG_DONTWAIT);
+    shutdown(client_fd, SHUT_WR);
+    if (_lingering.size() < k_linger_max && _poller->add(client_fd, Poller::EVENT_READ)) {
+        _setSlot(client_fd, FD_LINGER, NULL);
+        _lingering.push_back(std::make_pair(client_fd, TimerWheel::nowMs() + k_linger_ms));
+        return;
+    }
+    char buffer[4096];
+    while (recv(client_fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) {}
+    close(client_fd);
+}
+
+void Server::_handleLingerRead(int fd, ClientConnection*) {
+    char buffer[4096];
+    ssize_t n;
+    while ((n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {}
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        _closeLingering(fd);
+    }
+}
+
+// Also drops the fd's deadline, so the entry neither counts against
+// k_linger_max nor outlives the fd and closes a later one with its number.
+void Server::_closeLingering(int fd) {
+    for (std::deque<std::pair<int, unsigned long> >::iterator it = _lingering.begin(); it != _lingering.end(); ++it) {
+        if (it->first == fd) {
+            _lingering.erase(it);
+            break;
+        }
+    }
+    _poller->remove(fd);
+    close(fd);
+    _clearSlot(fd);
+}
+
+void Server::_handleClientData(int client_fd, ClientConnection* client) {
     std::cerr << "DEBUG: Entering _handleClientData for client " << client_fd << std::endl; fflush(stderr);
-    if (_clients.find(client_fd) == _clients.end()) return;
-    ClientConnection* client = _clients[client_fd];
 
-    if (client->readRequest() > 0) {
-        // Find the corresponding location to check client_max_body_size
+    if (client->getPut()) {
+        _processInput(client); // The PUT body is spliced from the socket
+        return;
+    }
+    // Bytes are read even while a response is pending, so pipelined
+    // requests queue up in the connection instead of the socket.
+    if (client->getBufferedInput() >= k_pipeline_buffer && _isBusy(client)) {
+        if (!(_poller->getInterest(client_fd) & Poller::EVENT_READ)) {
+            _closeClient(client_fd); // Hangup reported while paused
+            return;
+        }
+        _pauseReading(client_fd, true);
+        return;
+    }
+    ssize_t bytes_read = client->readRequest();
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return; // Spurious wakeup, nothing to read yet
+    }
+    if (bytes_read > 0) {
+        _processInput(client);
+    } else {
+        _closeClient(client_fd);
+    }
+}
+
+// True while the connection still owes the client a response; the next
+// request is not parsed before then, so responses go out in request order.
+bool Server::_isBusy(ClientConnection* client) const {
+    return client->getCgiPid() != 0 || _listings.count(client->getFd())
+        || !client->getResponseBuffer().empty() || client->getSharedRemaining() > 0
+        || client->getFileRemaining() > 0;
+}
+
+// Stops or resumes read events for a client. A paused fd stays registered
+// (EVENT_ERROR alone) so write interest can still be toggled on it.
+void Server::_pauseReading(int client_fd, bool paused) {
+    int interest = _poller->getInterest(client_fd);
+    if (interest == 0) return;
+    int wanted = paused ? ((interest & ~Poller::EVENT_READ) | Poller::EVENT_ERROR)
+                        : ((interest | Poller::EVENT_READ) & ~Poller::EVENT_ERROR);
+    if (wanted != interest) {
+        _poller->modify(client_fd, wanted);
+    }
+}
+
+// Parses buffered input and dispatches each complete request in turn, until
+// a response is pending or the input ends mid-request.
+void Server::_processInput(ClientConnection* client) {
+    int client_fd = client->getFd();
+    if (!_isBusy(client)) {
+        _pauseReading(client_fd, false);
+    }
+    while (!_isBusy(client)) {
+        if (client->getPut()) {
+            if (!_receivePut(client)) return; // Waiting for the body, or answered
+            continue;
+        }
+        if (client->parseInput() == 0 && !client->isRequestComplete()) {
+            return; // Nothing new to parse: wait for more bytes
+        }
+
+        // The location is decided as soon as the head is in, before the body
         const HttpRequest& temp_req = client->getRequest();
         std::cerr << "DEBUG: Client " << client_fd << " requested URI: " << temp_req.getUri() << std::endl; fflush(stderr);
-        const std::vector<LocationConfig*>& locations = _config.getLocations();
-        const LocationConfig* matched_location = NULL;
-        std::string longest_match = "";
-
-        for (size_t i = 0; i < locations.size(); ++i) {
-            if (temp_req.getUri().rfind(locations[i]->path, 0) == 0) {
-                if (locations[i]->path.length() > longest_match.length()) {
-                    longest_match = locations[i]->path;
-                    matched_location = locations[i];
-                }
+        const LocationConfig* matched_location = _config.findLocation(temp_req.getUri());
+
+        client->setLocation(matched_location);
+        client->setHeadOnly(temp_req.getMethod() == "HEAD");
+        int parse_error = client->getParseError();
+        if (parse_error != 0) {
+            _rejectBody(client, parse_error, ErrorPages::reasonPhrase(parse_error), matched_location);
+            return;
+        }
+        const LocationPlan& plan = _planFor(matched_location);
+        RequestHandler handler = _handlerFor(temp_req, plan);
+        if (client->isParsingBody() && !client->isBodyAdmitted()) {
+            if (!_admitBody(client, plan, handler)) return;
+        }
+        if (handler == &Server::_handlePut && (client->isParsingBody() || client->isRequestComplete())) {
+            // The body bypasses the parser: socket to file
+            if (!_beginPut(client, plan)) return;
+            continue;
+        }
+        if (client->isParsingBody()) {
+            // Uploads are written to disk as the body arrives
+            if (handler == &Server::_handleUpload) {
+                client->setUploadDir(plan.upload_dir);
+            }
+            _armTimer(client, ClientConnection::TIMEOUT_BODY);
+        } else if (!client->isRequestComplete()) {
+            _armTimer(client, ClientConnection::TIMEOUT_HEADER);
+        }
+
+        if (!client->isRequestComplete()) {
+            continue; // Returns above once the buffered input is used up
+        }
+        // The response path arms the send timer once something is queued.
+        _armTimer(client, ClientConnection::TIMEOUT_NONE);
+        _dispatchRequest(client);
+    }
+}
+
+// Decides on a body from the head alone, before any of it is read: refuses
+// what the handler would refuse anyway, a Content-Length over the location's
+// limit and unknown expectations, then answers "Expect: 100-continue" so the
+// client starts sending. Chunked and multipart bodies are held to the limit
+// by the parser as they arrive. Returns false if the request was answered.
+bool Server::_admitBody(ClientConnection* client, const LocationPlan& plan, RequestHandler handler) {
+    const HttpRequest& req = client->getRequest();
+    if (handler == &Server::_handleNotAllowed) {
+        _rejectBody(client, 405, "Method Not Allowed", plan.loc);
+        return false;
+    }
+    if (handler == &Server::_handleNotImplemented) {
+        _rejectBody(client, 501, "Not Implemented", plan.loc);
+        return false;
+    }
+    size_t max_body_size = plan.loc ? plan.loc->client_max_body_size : 1 * 1024 * 1024;
+    bool chunked = req.getHeader("Transfer-Encoding") == "chunked";
+    if (!chunked && std::strtoul(req.getHeader("Content-Length").c_str(), NULL, 10) > max_body_size) {
+        _rejectBody(client, 413, "Payload Too Large", plan.loc);
+        return false;
+    }
+    const std::string& expect = req.getHeader("Expect");
+    if (!expect.empty() && strcasecmp(expect.c_str(), "100-continue") != 0) {
+        _rejectBody(client, 417, "Expectation Failed", plan.loc);
+        return false;
+    }
+    client->admitBody(max_body_size);
+    // Nothing is queued while a request is parsed, so this fits in the send
+    // buffer; a client that sent body bytes already is not waiting for it.
+    if (!expect.empty() && req.getVersion() == "HTTP/1.1" && !client->hasBufferedInput()) {
+        send(client->getFd(), k_continue_response, sizeof(k_continue_response) - 1, MSG_DONTWAIT);
+    }
+    return true;
+}
+
+// Answers a request that was not read to its end: refused from its head,
+// unparseable or timed out. The rest of it may still be on its way: stop
+// reading and close after the reply rather than parse it as the next
+// request.
+void Server::_rejectBody(ClientConnection* client, int code, const std::string& message, const LocationConfig* loc) {
+    if (!client->isRequestComplete()) {
+        client->setCloseAfterWrite(true);
+        _poller->modify(client->getFd(), Poller::EVENT_WRITE);
+    }
+    client->setPut(NULL);
+    _sendErrorResponse(client, code, message, loc);
+    client->replaceParser();
+}
+
+// "bytes first-last/total" (total may be "*").
+static bool parseContentRange(const std::string& value, off_t& first, off_t& last) {
+    if (value.compare(0, 6, "bytes ") != 0) return false;
+    const char* p = value.c_str() + 6;
+    char* end;
+    first = std::strtoul(p, &end, 10);
+    if (end == p || *end != '-') return false;
+    p = end + 1;
+    last = std::strtoul(p, &end, 10);
+    return end != p && *end == '/' && last >= first;
+}
+
+// Checks a PUT and opens its destination: the last URI segment in the
+// location's upload directory. Returns false if it was answered instead.
+bool Server::_beginPut(ClientConnection* client, const LocationPlan& plan) {
+    const HttpRequest& req = client->getRequest();
+    std::string name = req.getUri().substr(0, req.getUri().find('?'));
+    name = name.substr(name.find_last_of('/') + 1);
+    if (name.empty() || name == "." || name == "..") {
+        _rejectBody(client, 400, "Bad Request", plan.loc);
+        return false;
+    }
+
+    bool chunked = req.getHeader("Transfer-Encoding") == "chunked";
+    size_t length = chunked ? 0 : std::strtoul(req.getHeader("Content-Length").c_str(), NULL, 10);
+    size_t max_body_size = plan.loc ? plan.loc->client_max_body_size : 1 * 1024 * 1024;
+
+    // A ranged PUT resumes a partial file, so it may not leave a hole
+    std::string path = plan.upload_dir + name;
+    const std::string& range = req.getHeader("Content-Range");
+    off_t first = 0, last = 0;
+    if (!range.empty()) {
+        if (!parseContentRange(range, first, last) || (!chunked && static_cast<size_t>(last - first + 1) != length)) {
+            _rejectBody(client, 400, "Bad Request", plan.loc);
+            return false;
+        }
+        struct stat st;
+        off_t size = stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+        if (first > size) {
+            if (client->isParsingBody()) {
+                client->setCloseAfterWrite(true);
+                _poller->modify(client->getFd(), Poller::EVENT_WRITE);
             }
+            queueRangeNotSatisfiable(client, size);
+            _finishRequest(client);
+            return false;
+        }
+    }
+
+    // A chunked body must fill the declared range exactly
+    if (!range.empty() && chunked) {
+        length = static_cast<size_t>(last - first + 1);
+        max_body_size = std::min(max_body_size, length);
+    }
+    PutUpload* put = new PutUpload();
+    client->setPut(put);
+    if (!put->open(path, chunked, length, first, !range.empty(), max_body_size)) {
+        int error = errno; // Logging may overwrite it
+        std::cerr << "PUT: cannot open " << path << ": " << strerror(error) << std::endl; fflush(stderr);
+        _rejectBody(client, error == EACCES ? 403 : 500, error == EACCES ? "Forbidden" : "Internal Server Error", plan.loc);
+        return false;
+    }
+    return true;
+}
+
+// Moves PUT body bytes into the file: first what was read along with the
+// head, then straight from the socket, at most k_put_batch per wakeup.
+// Returns true once the body is in and the request was dispatched.
+bool Server::_receivePut(ClientConnection* client) {
+    PutUpload* put = client->getPut();
+    int client_fd = client->getFd();
+    if (client->hasBufferedInput()) {
+        client->consumeInput(put->consume(client->getBufferedData(), client->getBufferedInput()));
+    }
+    size_t moved = 0;
+    while (put->status() == PutUpload::RECEIVING && moved < k_put_batch) {
+        ssize_t n = put->receive(client_fd);
+        if (n > 0) {
+            moved += n;
+            continue;
         }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        _closeClient(client_fd); // Gone in the middle of the body
+        return false;
+    }
+
+    const LocationConfig* loc = client->getLocation();
+    switch (put->status()) {
+        case PutUpload::RECEIVING:
+            _armTimer(client, ClientConnection::TIMEOUT_BODY);
+            return false;
+        case PutUpload::TOO_LARGE:
+            _rejectBody(client, 413, "Payload Too Large", loc);
+            return false;
+        case PutUpload::MALFORMED:
+            _rejectBody(client, 400, "Bad Request", loc);
+            return false;
+        case PutUpload::FAILED:
+            _rejectBody(client, 500, "Internal Server Error", loc);
+            return false;
+        case PutUpload::DONE:
+            break;
+    }
+    client->finishBody();
+    _armTimer(client, ClientConnection::TIMEOUT_NONE);
+    _dispatchRequest(client);
+    return true;
+}
+
+static Server::Method methodOf(const std::string& name) {
+    if (name == "GET" || name == "HEAD") return Server::METHOD_GET;
+    if (name == "POST") return Server::METHOD_POST;
+    if (name == "DELETE") return Server::METHOD_DELETE;
+    if (name == "PUT") return Server::METHOD_PUT;
+    return Server::METHOD_OTHER;
+}
+
+// A complete response: status line, Content-Type/Length and the body.
+static std::string textResponse(int code, const std::string& reason, const std::string& body) {
+    HttpResponse res;
+    res.setStatusCode(code, reason);
+    std::stringstream ss_len; ss_len << body.length();
+    res.addHeader("Content-Length", ss_len.str());
+    res.setBody(body);
+    return res.toString();
+}
+
+void Server::_compilePlans() {
+    const std::vector<LocationConfig*>& locations = _config.getLocations();
+    _plans.resize(locations.size() + 1);
+    _compilePlan(_plans[0], NULL);
+    for (size_t i = 0; i < locations.size(); ++i) {
+        _compilePlan(_plans[locations[i]->id + 1], locations[i]);
+    }
+}
+
+// Decides, once per location, which handler each method goes to, so a
+// request costs a table lookup instead of re-walking the configuration.
+void Server::_compilePlan(LocationPlan& plan, const LocationConfig* loc) {
+    plan.loc = loc;
+    plan.root = (loc && !loc->root.empty()) ? loc->root : _config.getRoot();
+    plan.indexes = (loc && !loc->index.empty()) ? loc->index : std::vector<std::string>(1, "index.html");
+    plan.index_key.clear();
+    for (size_t i = 0; i < plan.indexes.size(); ++i) plan.index_key += std::string(1, '\0') + plan.indexes[i];
+    plan.upload_dir = loc ? loc->upload_path : "";
+    if (!plan.upload_dir.empty() && plan.upload_dir[plan.upload_dir.length() - 1] != '/') plan.upload_dir += "/";
+    plan.cgi_ext = (loc && !loc->cgi_path.empty()) ? loc->cgi_ext : "";
+    plan.redirect = NULL;
+    plan.redirect_close = NULL;
+
+    unsigned int allowed = ~0u;
+    if (loc && !loc->allowed_methods.empty()) {
+        allowed = 0;
+        for (size_t i = 0; i < loc->allowed_methods.size(); ++i) allowed |= 1u << methodOf(loc->allowed_methods[i]);
+    }
+    if (loc && !loc->redirect.empty()) {
+        HttpResponse res;
+        res.setStatusCode(301, "Moved Permanently");
+        res.addHeader("Location", loc->redirect);
+        res.addHeader("Content-Length", "0");
+        plan.redirect = new SharedBuffer(res.toString());
+        res.addHeader("Connection", "close");
+        plan.redirect_close = new SharedBuffer(res.toString());
+    }
 
-        size_t max_body_size = 1 * 1024 * 1024; // Default 1MB
-        if (matched_location) {
-            max_body_size = matched_location->client_max_body_size;
+    plan.cgi_methods = 0;
+    for (int m = 0; m < METHOD_COUNT; ++m) {
+        RequestHandler& handler = plan.handlers[m];
+        if (!(allowed & (1u << m))) {
+            handler = &Server::_handleNotAllowed;
+        } else if (plan.redirect) {
+            handler = &Server::_handleRedirect;
+        } else if (loc && loc->stats) {
+            handler = &Server::_handleStats;
+        } else {
+            if (!plan.cgi_ext.empty()) plan.cgi_methods |= 1u << m;
+            if (m == METHOD_GET) handler = &Server::_handleStatic;
+            else if (m == METHOD_POST) handler = plan.upload_dir.empty() ? &Server::_handleNotAllowed : &Server::_handleUpload;
+            else if (m == METHOD_DELETE) handler = &Server::_handleDelete;
+            else if (m == METHOD_PUT) handler = plan.upload_dir.empty() ? &Server::_handleNotAllowed : &Server::_handlePut;
+            else handler = &Server::_handleNotImplemented;
         }
+    }
+}
 
-        if (client->getRequestBufferSize() > max_body_size) {
-            _sendErrorResponse(client, 413, "Payload Too Large", matched_location);
+const Server::LocationPlan& Server::_planFor(const LocationConfig* loc) const {
+    return _plans[loc ? loc->id + 1 : 0];
+}
+
+// Routes a complete request through its location's plan. Only the CGI
+// suffix check looks at the URI here; everything else was decided at load.
+Server::RequestHandler Server::_handlerFor(const HttpRequest& req, const LocationPlan& plan) const {
+    Method method = methodOf(req.getMethod());
+    if (plan.cgi_methods & (1u << method)) {
+        const std::string& uri = req.getUri();
+        if (uri.length() >= plan.cgi_ext.length()
+            && uri.compare(uri.length() - plan.cgi_ext.length(), plan.cgi_ext.length(), plan.cgi_ext) == 0) {
+            return &Server::_handleCgi;
+        }
+    }
+    return plan.handlers[method];
+}
+
+void Server::_dispatchRequest(ClientConnection* client) {
+    const LocationPlan& plan = _planFor(client->getLocation());
+    RequestHandler handler = _handlerFor(client->getRequest(), plan);
+    (this->*handler)(client, plan);
+}
+
+// Queues the response the handler left in the client and readies the
+// parser for the connection's next request.
+void Server::_finishRequest(ClientConnection* client) {
+    client->replaceParser();
+    _queueWrite(client);
+}
+
+void Server::_handleNotAllowed(ClientConnection* client, const LocationPlan& plan) {
+    _sendErrorResponse(client, 405, "Method Not Allowed", plan.loc);
+    client->replaceParser();
+}
+
+void Server::_handleNotImplemented(ClientConnection* client, const LocationPlan& plan) {
+    _sendErrorResponse(client, 501, "Not Implemented", plan.loc);
+    client->replaceParser();
+}
+
+void Server::_handleRedirect(ClientConnection* client, const LocationPlan& plan) {
+    client->setSharedResponse((client->shouldCloseAfterWrite() ? plan.redirect_close : plan.redirect)->retain());
+    _finishRequest(client);
+}
+
+void Server::_handleStats(ClientConnection* client, const LocationPlan&) {
+    HttpResponse res;
+    std::string body = _statsBody();
+    res.setStatusCode(200, "OK");
+    res.addHeader("Content-Type", "text/plain");
+    std::stringstream ss_len; ss_len << body.length();
+    res.addHeader("Content-Length", ss_len.str());
+    res.setBody(body);
+    client->setResponse(res.toString());
+    _finishRequest(client);
+}
+
+// The response comes later, from the CGI's output.
+void Server::_handleCgi(ClientConnection* client, const LocationPlan& plan) {
+    _executeCgi(client, plan.loc);
+    if (client->getCgiPid() == 0) {
+        client->replaceParser(); // Failed to start: the error reply is queued
+    }
+}
+
+// GET: a file (after the .html fallback and index lookup), a directory
+// listing, 403 or 404.
+void Server::_handleStatic(ClientConnection* client, const LocationPlan& plan) {
+    const LocationConfig* loc = plan.loc;
+    std::string uri = client->getRequest().getUri();
+    std::string filePath = plan.root + uri;
+    std::string resolved;
+    PathCache::Kind kind = _resolvePath(filePath, uri, plan, resolved, true);
+    if (kind == PathCache::PATH_FILE && !_serveFile(client, resolved)) {
+        // Changed since it was cached: resolve again from disk
+        kind = _resolvePath(filePath, uri, plan, resolved, false);
+        if (kind == PathCache::PATH_FILE && !_serveFile(client, resolved)) {
+            kind = PathCache::PATH_ABSENT;
+        }
+    }
+
+    if (kind == PathCache::PATH_DIRECTORY) {
+        if (uri[uri.length() - 1] != '/') {
+            uri += "/";
+        }
+        if (!loc || !loc->autoindex) {
+            // No index and autoindex is off
+            _sendErrorResponse(client, 403, "Forbidden", loc);
+            client->replaceParser();
+            return;
+        }
+        // Rendered over several loop iterations unless cached
+        if (!_listDirectory(client, resolved, uri, loc)) {
             client->replaceParser();
             return;
         }
+    } else if (kind == PathCache::PATH_ABSENT) {
+        // Not a file and not a directory
+        _sendErrorResponse(client, 404, "Not Found", loc);
+        client->replaceParser();
+        return;
+    }
+    _finishRequest(client);
+}
 
-        if (client->isRequestComplete()) {
-            const HttpRequest& req = client->getRequest();
-            HttpResponse res;
+// POST of multipart/form-data into the location's upload directory.
+void Server::_handleUpload(ClientConnection* client, const LocationPlan& plan) {
+    const HttpRequest& req = client->getRequest();
+    int client_fd = client->getFd();
+    std::string content_type = req.getHeader("Content-Type");
+    std::cerr << "DEBUG: Client " << client_fd << " Received Content-Type: '" << content_type << "'" << std::endl; fflush(stderr);
+    if (content_type.find("multipart/form-data") == std::string::npos) {
+        client->setResponse(textResponse(400, "Bad Request", "Unsupported Content-Type for upload."));
+        _finishRequest(client);
+        return;
+    }
+    const std::vector<HttpRequest::UploadedFile>& uploadedFiles = req.getUploadedFiles();
+    if (uploadedFiles.empty()) {
+        client->setResponse(textResponse(400, "Bad Request", "No files uploaded."));
+        _finishRequest(client);
+        return;
+    }
 
-            // Enforce allowed methods if configured for the matched location
-            if (matched_location && !matched_location->allowed_methods.empty()) {
-                bool method_allowed = false;
-                for (size_t i = 0; i < matched_location->allowed_methods.size(); ++i) {
-                    if (req.getMethod() == matched_location->allowed_methods[i]) {
-                        method_allowed = true;
-                        break;
-                    }
-                }
-                if (!method_allowed) {
-                    _sendErrorResponse(client, 405, "Method Not Allowed", matched_location);
-                    client->replaceParser();
-                    return;
-                }
-            }
+    const std::string& upload_dir = plan.upload_dir;
+    // Check if directory exists and is writable
+    struct stat dir_stat;
+    if (stat(upload_dir.c_str(), &dir_stat) != 0) {
+        std::cerr << "DEBUG: Client " << client_fd << " Upload directory does not exist: " << upload_dir << " Error: " << strerror(errno) << std::endl; fflush(stderr);
+        client->setResponse(textResponse(500, "Internal Server Error", "Upload directory does not exist or is inaccessible."));
+        _finishRequest(client);
+        return;
+    }
+    if (!S_ISDIR(dir_stat.st_mode)) {
+        std::cerr << "DEBUG: Client " << client_fd << " Upload path is not a directory: " << upload_dir << std::endl; fflush(stderr);
+        client->setResponse(textResponse(500, "Internal Server Error", "Upload path is not a directory."));
+        _finishRequest(client);
+        return;
+    }
+    if (access(upload_dir.c_str(), W_OK) != 0) {
+        std::cerr << "DEBUG: Client " << client_fd << " Upload directory not writable: " << upload_dir << " Error: " << strerror(errno) << std::endl; fflush(stderr);
+        client->setResponse(textResponse(403, "Forbidden", "Upload directory is not writable."));
+        _finishRequest(client);
+        return;
+    }
 
-            // Handle redirection if configured
-            if (matched_location && !matched_location->redirect.empty()) {
-                res.setStatusCode(301, "Moved Permanently");
-                res.addHeader("Location", matched_location->redirect);
-                client->setResponse(res.toString());
-                FD_SET(client_fd, &_write_fds);
-                client->replaceParser();
-                return;
-            }
+    // Parts were streamed into the directory while the body arrived
+    bool all_saved = true;
+    for (size_t i = 0; i < uploadedFiles.size(); ++i) {
+        const HttpRequest::UploadedFile& file = uploadedFiles[i];
+        if (file.failed || file.path.empty()) {
+            all_saved = false;
+            break;
+        }
+        std::cout << "Uploaded file saved to: " << file.path << std::endl;
+    }
+    if (all_saved) {
+        client->setResponse(textResponse(200, "OK", "File(s) uploaded successfully!"));
+    } else {
+        client->setResponse(textResponse(500, "Internal Server Error", "Failed to save some files."));
+    }
+    _finishRequest(client);
+}
 
-            bool is_cgi = false;
-            if (matched_location && !matched_location->cgi_path.empty() && !matched_location->cgi_ext.empty()) {
-                const std::string& ext = matched_location->cgi_ext;
-                const std::string& uri = req.getUri();
-                if (uri.length() >= ext.length() && uri.substr(uri.length() - ext.length()) == ext) {
-                    is_cgi = true;
-                }
-            }
+void Server::_handleDelete(ClientConnection* client, const LocationPlan& plan) {
+    std::string filePath = plan.root + client->getRequest().getUri();
+    if (std::remove(filePath.c_str()) != 0) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            _sendErrorResponse(client, 404, "Not Found", plan.loc);
+        } else if (errno == EACCES || errno == EPERM) {
+            _sendErrorResponse(client, 403, "Forbidden", plan.loc);
+        } else {
+            _sendErrorResponse(client, 500, "Internal Server Error", plan.loc);
+        }
+        client->replaceParser();
+        return;
+    }
+    HttpResponse res;
+    res.setStatusCode(204, "No Content");
+    client->setResponse(res.toString());
+    _finishRequest(client);
+}
 
-            if (is_cgi) {
-                _executeCgi(client, matched_location);
-                return;
-            }
+// The body is in the file by now: 201 with Location for a new file, 204
+// otherwise, with the stored size (where a ranged PUT would resume) in
+// Upload-Offset either way.
+void Server::_handlePut(ClientConnection* client, const LocationPlan& plan) {
+    PutUpload* put = client->getPut();
+    if (!put || !put->commit()) {
+        std::cerr << "PUT: could not store " << client->getRequest().getUri() << ": " << strerror(errno) << std::endl; fflush(stderr);
+        client->setPut(NULL);
+        _sendErrorResponse(client, 500, "Internal Server Error", plan.loc);
+        client->replaceParser();
+        return;
+    }
+    HttpResponse res;
+    if (put->created()) {
+        res.setStatusCode(201, "Created");
+        res.addHeader("Location", client->getRequest().getUri());
+        res.addHeader("Content-Length", "0");
+    } else {
+        res.setStatusCode(204, "No Content");
+    }
+    std::stringstream ss_size; ss_size << put->storedSize();
+    res.addHeader("Upload-Offset", ss_size.str());
+    client->setPut(NULL);
+    client->setResponse(res.toString());
+    _finishRequest(client);
+}
 
-            if (req.getMethod() == "DELETE") {
-                std::string root = _config.getRoot();
-                if (matched_location && !matched_location->root.empty()) {
-                    root = matched_location->root;
-                }
-                std::string filePath = root + req.getUri();
+void Server::_closeClient(int client_fd) {
+    ClientConnection* client = _slotOf(client_fd).owner;
+    _poller->remove(client_fd);
+    close(client_fd);
+    _clearSlot(client_fd);
+    if (!client) return;
+
+    // Tear down a CGI that was still working for this client.
+    if (client->getCgiPipeFd() >= 0) _closeCgiPipe(client->getCgiPipeFd());
+    if (client->getCgiStdinFd() >= 0) _closeCgiPipe(client->getCgiStdinFd());
+    if (client->getCgiPid() > 0) {
+        kill(client->getCgiPid(), SIGKILL);
+        waitpid(client->getCgiPid(), NULL, 0);
+    }
 
-                if (access(filePath.c_str(), F_OK) == 0) {
-                    if (std::remove(filePath.c_str()) == 0) {
-                        res.setStatusCode(204, "No Content");
-                    } else {
-                        if (errno == EACCES) {
-                            res.setStatusCode(403, "Forbidden");
-                        } else {
-                            res.setStatusCode(500, "Internal Server Error");
-                        }
-                    }
-                } else {
-                    res.setStatusCode(404, "Not Found");
-                }
-            } else if (req.getMethod() == "POST") {
-                // Uploads are now handled by checking if a location has an upload_path
-                if (matched_location && !matched_location->upload_path.empty()) {
-                    std::string content_type = req.getHeader("Content-Type");
-                    std::cerr << "DEBUG: Client " << client_fd << " Received Content-Type: '" << content_type << "'" << std::endl; fflush(stderr);
-                    if (content_type.find("multipart/form-data") != std::string::npos) {
-                        const std::vector<HttpRequest::UploadedFile>& uploadedFiles = req.getUploadedFiles();
-                        if (uploadedFiles.empty()) {
-                            res.setStatusCode(400, "Bad Request");
-                            res.setBody("No files uploaded.");
-                        } else {
-                            bool all_saved = true;
-                            std::string upload_dir = matched_location->upload_path;
-                            // Ensure upload_dir ends with a slash
-                            if (upload_dir[upload_dir.length() - 1] != '/') {
-                                upload_dir += "/";
-                            }
-                            std::cerr << "DEBUG: Client " << client_fd << " Resolved upload directory: " << upload_dir << std::endl; fflush(stderr);
-
-                            // Check if directory exists and is writable
-                            struct stat dir_stat;
-                            if (stat(upload_dir.c_str(), &dir_stat) != 0) {
-                                std::cerr << "DEBUG: Client " << client_fd << " Upload directory does not exist: " << upload_dir << " Error: " << strerror(errno) << std::endl; fflush(stderr);
-                                all_saved = false;
-                                res.setStatusCode(500, "Internal Server Error");
-                                std::string body = "Upload directory does not exist or is inaccessible.";
-                                res.setBody(body);
-                                std::stringstream ss_len; ss_len << body.length();
-                                res.addHeader("Content-Length", ss_len.str());
-                                client->setResponse(res.toString());
-                                FD_SET(client_fd, &_write_fds);
-                                client->replaceParser();
-                                return;
-                            }
-                            if (!S_ISDIR(dir_stat.st_mode)) {
-                                std::cerr << "DEBUG: Client " << client_fd << " Upload path is not a directory: " << upload_dir << std::endl; fflush(stderr);
-                                all_saved = false;
-                                res.setStatusCode(500, "Internal Server Error");
-                                std::string body = "Upload path is not a directory.";
-                                res.setBody(body);
-                                std::stringstream ss_len; ss_len << body.length();
-                                res.addHeader("Content-Length", ss_len.str());
-                                client->setResponse(res.toString());
-                                FD_SET(client_fd, &_write_fds);
-                                client->replaceParser();
-                                return;
-                            }
-                            if (access(upload_dir.c_str(), W_OK) != 0) {
-                                std::cerr << "DEBUG: Client " << client_fd << " Upload directory not writable: " << upload_dir << " Error: " << strerror(errno) << std::endl; fflush(stderr);
-                                all_saved = false;
-                                res.setStatusCode(403, "Forbidden");
-                                std::string body = "Upload directory is not writable.";
-                                res.setBody(body);
-                                std::stringstream ss_len; ss_len << body.length();
-                                res.addHeader("Content-Length", ss_len.str());
-                                client->setResponse(res.toString());
-                                FD_SET(client_fd, &_write_fds);
-                                client->replaceParser();
-                                return;
-                            }
-                            std::cerr << "DEBUG: Client " << client_fd << " Upload directory is valid and writable." << std::endl; fflush(stderr);
-
-                            for (size_t i = 0; i < uploadedFiles.size(); ++i) {
-                                const HttpRequest::UploadedFile& file = uploadedFiles[i];
-                                std::string safe_filename = upload_dir;
-                                // Basic sanitization: remove path separators
-                                size_t last_slash = file.filename.find_last_of("/");
-                                if (last_slash == std::string::npos) {
-                                    last_slash = file.filename.find_last_of("\\");
-                                }
-                                if (last_slash != std::string::npos) {
-                                    safe_filename += file.filename.substr(last_slash + 1);
-                                } else {
-                                    safe_filename += file.filename;
-                                }
-
-                                std::cerr << "DEBUG: Client " << client_fd << " Attempting to save file to: " << safe_filename << std::endl; fflush(stderr);
-                                std::ofstream outfile(safe_filename.c_str(), std::ios::binary);
-                                if (outfile.is_open()) {
-                                    std::cerr << "DEBUG: Client " << client_fd << " File stream opened successfully for: " << safe_filename << std::endl; fflush(stderr);
-                                    outfile.write(file.content.c_str(), file.content.length());
-                                    outfile.close();
-                                    std::cout << "Uploaded file saved to: " << safe_filename << std::endl;
-                                } else {
-                                    std::cerr << "DEBUG: Client " << client_fd << " Failed to open file stream for: " << safe_filename << " Error: " << strerror(errno) << std::endl; fflush(stderr);
-                                    all_saved = false;
-                                    break;
-                                }
-                            }
-                            if (all_saved) {
-                                res.setStatusCode(200, "OK");
-                                std::string body = "File(s) uploaded successfully!";
-                                res.setBody(body);
-                                std::stringstream ss_len; ss_len << body.length();
-                                res.addHeader("Content-Length", ss_len.str());
-                            } else {
-                                res.setStatusCode(500, "Internal Server Error");
-                                std::string body = "Failed to save some files.";
-                                res.setBody(body);
-                                std::stringstream ss_len; ss_len << body.length();
-                                res.addHeader("Content-Length", ss_len.str());
-                            }
-                        }
-                    } else {
-                        res.setStatusCode(400, "Bad Request");
-                        std::string body = "Unsupported Content-Type for upload.";
-                        res.setBody(body);
-                        std::stringstream ss_len; ss_len << body.length();
-                        res.addHeader("Content-Length", ss_len.str());
-                    }
-                    client->setResponse(res.toString()); // ADDED THIS LINE
-                } else { // Other POST requests
-                    res.setStatusCode(405, "Method Not Allowed");
-                    std::string body = "Method Not Allowed for this resource.";
-                    res.setBody(body);
-                    std::stringstream ss_len; ss_len << body.length();
-                    res.addHeader("Content-Length", ss_len.str());
-                    client->setResponse(res.toString()); // ADDED THIS LINE
-                }
-            } else { // GET method
-                std::string root = _config.getRoot();
-                if (matched_location && !matched_location->root.empty()) {
-                    root = matched_location->root;
-                }
+    std::map<int, Listing>::iterator listing = _listings.find(client_fd);
+    if (listing != _listings.end()) {
+        delete listing->second.job;
+        _listings.erase(listing);
+    }
 
-                std::string uri = req.getUri();
-                if (uri == "/") {
-                    uri = "/index.html";
-                    if (matched_location && !matched_location->index.empty()) {
-                        uri = "/" + matched_location->index;
-                    }
-                }
-                
-                                std::string filePath = root + uri;
-                                std::cerr << "DEBUG: Client " << client_fd << " attempting to serve file: " << filePath << std::endl; fflush(stderr);
-                                                std::ifstream file(filePath.c_str());
-                bool file_found = file.is_open();
-
-                if (!file_found) {
-                    // If not found, and URI doesn't have an extension, try appending .html
-                    size_t dot_pos = uri.rfind('.');
-                    // Check if there's no dot, or if the dot is part of a directory name (e.g., /path.to/file)
-                    if (dot_pos == std::string::npos || dot_pos < uri.rfind('/')) {
-                        std::string html_filePath = filePath + ".html";
-                        std::cerr << "DEBUG: Client " << client_fd << " attempting to serve file with .html extension: " << html_filePath << std::endl; fflush(stderr);
-                        std::ifstream html_file(html_filePath.c_str());
-                        if (html_file.is_open()) {
-                            filePath = html_filePath; // Update filePath to the .html version
-                            file.swap(html_file); // Use the opened .html file
-                            file_found = true;
-                        }
-                    }
-                }
+    _timers.cancel(client->getTimer());
+    delete client;
+    --_client_count;
+    _pauseAccept(false);
+}
+
+void Server::_closeCgiPipe(int pipe_fd) {
+    ClientConnection* client = _slotOf(pipe_fd).owner;
+    if (client) {
+        if (client->getCgiPipeFd() == pipe_fd) client->setCgiPipeFd(-1);
+        if (client->getCgiStdinFd() == pipe_fd) client->setCgiStdinFd(-1);
+    }
+    _poller->remove(pipe_fd);
+    close(pipe_fd);
+    _clearSlot(pipe_fd);
+    _pauseAccept(false);
+}
 
-                if (file_found) {
-                    // It's a file, serve it
-                    std::stringstream buffer; buffer << file.rdbuf();
-                    res.setStatusCode(200, "OK");
-                    res.addHeader("Content-Type", getMimeType(filePath));
-                    std::stringstream ss_len; ss_len << buffer.str().length();
-                    res.addHeader("Content-Length", ss_len.str());
-                    res.setBody(buffer.str());
-                    client->setResponse(res.toString());
+Server::FdSlot Server::_slotOf(int fd) const {
+    if (fd < 0 || static_cast<size_t>(fd) >= _fd_table.size()) return FdSlot();
+    return _fd_table[fd];
+}
+
+void Server::_setSlot(int fd, FdType type, ClientConnection* owner) {
+    if (static_cast<size_t>(fd) >= _fd_table.size()) {
+        _fd_table.resize(fd + 1);
+    }
+    _fd_table[fd].type = type;
+    _fd_table[fd].owner = owner;
+}
+
+void Server::_clearSlot(int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= _fd_table.size()) return;
+    _fd_table[fd] = FdSlot();
+}
+
+void Server::_queueWrite(ClientConnection* client) {
+    client->dropHeadBody();
+    _poller->setWriteInterest(client->getFd(), true);
+    _armTimer(client, ClientConnection::TIMEOUT_SEND);
+}
+
+long Server::_timeoutFor(ClientConnection::TimeoutKind kind, const LocationConfig* loc) const {
+    long value = -1;
+    switch (kind) {
+        case ClientConnection::TIMEOUT_HEADER:
+            if (loc) value = loc->client_header_timeout;
+            return value >= 0 ? value : _config.getClientHeaderTimeout();
+        case ClientConnection::TIMEOUT_BODY:
+            if (loc) value = loc->client_body_timeout;
+            return value >= 0 ? value : _config.getClientBodyTimeout();
+        case ClientConnection::TIMEOUT_KEEPALIVE:
+            if (loc) value = loc->keepalive_timeout;
+            return value >= 0 ? value : _config.getKeepaliveTimeout();
+        case ClientConnection::TIMEOUT_SEND:
+            if (loc) value = loc->send_timeout;
+            return value >= 0 ? value : _config.getSendTimeout();
+        default:
+            return 0;
+    }
+}
+
+// (Re)arms the connection's single timer for the given phase. The header
+// deadline is absolute from the first byte of the request, so a client
+// trickling bytes cannot extend it; the other timeouts restart on progress.
+void Server::_armTimer(ClientConnection* client, ClientConnection::TimeoutKind kind) {
+    long timeout = _timeoutFor(kind, client->getLocation());
+    if (timeout <= 0) {
+        _timers.cancel(client->getTimer());
+        client->setTimeoutKind(ClientConnection::TIMEOUT_NONE);
+        return;
+    }
+    if (kind == ClientConnection::TIMEOUT_HEADER) {
+        unsigned long start = client->getRequestStart();
+        unsigned long elapsed = start ? TimerWheel::nowMs() - start : 0;
+        timeout = elapsed >= static_cast<unsigned long>(timeout) ? 0 : timeout - static_cast<long>(elapsed);
+    }
+    client->setTimeoutKind(kind);
+    _timers.schedule(client->getTimer(), static_cast<unsigned long>(timeout));
+}
+
+void Server::_handleTimeouts() {
+    std::vector<int> expired;
+    unsigned long now = TimerWheel::nowMs();
+    _timers.advance(now, expired);
+    _open_files.expire(now);
+    if (_accept_paused_at != 0 && now - _accept_paused_at >= k_accept_retry_ms) {
+        _pauseAccept(false); // Descriptors may have been freed elsewhere
+    }
+    while (!_lingering.empty() && _lingering.front().second <= now) {
+        _closeLingering(_lingering.front().first);
+    }
+
+    for (size_t i = 0; i < expired.size(); ++i) {
+        int fd = expired[i];
+        FdSlot slot = _slotOf(fd);
+        if (slot.type != FD_CLIENT) continue;
+        ClientConnection* client = slot.owner;
+        ClientConnection::TimeoutKind kind = client->getTimeoutKind();
+        client->setTimeoutKind(ClientConnection::TIMEOUT_NONE);
+
+        if ((kind == ClientConnection::TIMEOUT_HEADER || kind == ClientConnection::TIMEOUT_BODY)
+            && client->getRequestBytes() > 0) {
+            std::cout << "Client " << fd << " timed out reading the request, sending 408" << std::endl;
+            _rejectBody(client, 408, "Request Timeout", client->getLocation());
+        } else {
+            std::cout << "Client " << fd << " timed out, closing" << std::endl;
+            _closeClient(fd);
+        }
+    }
+}
+
+// Queues a 200 for a regular file, a 304 when the client's validators still
+// match, or a 206/416 when the request carries a Range header. Small files
+// come from the file cache as one prebuilt buffer; bigger ones send the
+// header block through the response buffer and stream the body from the fd
+// with sendfile(), so memory per download does not depend on the file size.
+// Returns false if the path is missing or not a regular file.
+bool Server::_serveFile(ClientConnection* client, const std::string& path) {
+    const HttpRequest& req = client->getRequest();
+    const LocationConfig* loc = client->getLocation();
+    std::string range = req.getHeader("Range");
+    std::string caching = cachingHeaders(loc);
+    std::string encoding;
+    OpenFileCache::File* file = NULL;
+    if (range.empty()) {
+        // Precompressed sidecars first, best encoding first, then the file itself.
+        std::vector<std::string> encodings;
+        if (loc && loc->gzip_static) encodings = acceptedEncodings(req.getHeader("Accept-Encoding"), k_sidecar_encodings, 2);
+        encodings.push_back("");
+        for (size_t i = 0; i < encodings.size() && !file; ++i) {
+            encoding = encodings[i];
+            const FileCache::Entry* cached = _cachedFile(path, encoding, file);
+            if (cached) {
+                Validators v = validatorsFor(cached->ino, cached->size, cached->mtime);
+                if (isNotModified(req, v)) {
+                    queueNotModified(client, v, caching);
                 } else {
-                    // File not found, check if it's a directory for autoindex or 404
-                    struct stat path_stat;
-                    if (stat(filePath.c_str(), &path_stat) == 0 && S_ISDIR(path_stat.st_mode)) {
-                        // It's a directory, check for index file or autoindex
-                        if (uri[uri.length() - 1] != '/') {
-                            uri += "/";
-                        }
-                        std::string index_file_path = filePath; // Use the original filePath (which is a directory)
-                        if (index_file_path[index_file_path.length() - 1] != '/') {
-                            index_file_path += "/";
-                        }
-                        index_file_path += "index.html"; // Default index file
-                        if (matched_location && !matched_location->index.empty()) {
-                            index_file_path = filePath; // Reset to directory path
-                            if (index_file_path[index_file_path.length() - 1] != '/') {
-                                index_file_path += "/";
-                            }
-                            index_file_path += matched_location->index;
-                        }
-                        
-                        std::ifstream index_file(index_file_path.c_str());
-                        if (index_file.is_open()) {
-                            // Serve index file
-                            std::stringstream buffer; buffer << index_file.rdbuf();
-                            res.setStatusCode(200, "OK");
-                            res.addHeader("Content-Type", "text/html");
-                            std::stringstream ss_len; ss_len << buffer.str().length();
-                            res.addHeader("Content-Length", ss_len.str());
-                            res.setBody(buffer.str());
-                            client->setResponse(res.toString());
-                        } else {
-                            // No index file, check for autoindex
-                            if (matched_location && matched_location->autoindex) {
-                                // Generate directory listing
-                                std::stringstream body_ss;
-                                body_ss << "<html><head><title>Index of " << uri << "</title></head><body><h1>Index of " << uri << "</h1><hr><ul>";
-                                
-                                DIR* dir = opendir(filePath.c_str());
-                                if (dir) {
-                                    struct dirent* ent;
-                                    while ((ent = readdir(dir)) != NULL) {
-                                        std::string name = ent->d_name;
-                                        if (name == ".") continue;
-                                        body_ss << "<li><a href=\"" << uri << (name == ".." ? "" : name) << (name == ".." ? "" : (ent->d_type == DT_DIR ? "/" : "")) << "\">" << name << (ent->d_type == DT_DIR ? "/" : "") << "</a></li>";
-                                    }
-                                    closedir(dir);
-                                }
-                                body_ss << "</ul><hr></body></html>";
-
-                                res.setStatusCode(200, "OK");
-                                res.addHeader("Content-Type", "text/html");
-                                std::string body = body_ss.str();
-                                std::stringstream ss_len; ss_len << body.length();
-                                res.addHeader("Content-Length", ss_len.str());
-                                res.setBody(body);
-                            } else {
-                                // No index and autoindex is off
-                                _sendErrorResponse(client, 403, "Forbidden", matched_location);
-                                client->replaceParser();
-                                return;
-                            }
-                        }
-                    } else {
-                        // Not a file and not a directory
-                        _sendErrorResponse(client, 404, "Not Found", matched_location);
-                        client->replaceParser();
-                        return;
-                    }
+                    client->setResponse(insertHeaders(cached->headers, caching) + cached->body);
                 }
+                return true;
             }
-            client->replaceParser();
-            FD_SET(client_fd, &_write_fds);
         }
     } else {
-        close(client_fd);
-        FD_CLR(client_fd, &_master_set);
-        FD_CLR(client_fd, &_write_fds);
-        delete _clients[client_fd];
-        _clients.erase(client_fd);
+        // Ranges are always cut from the file itself, never from a cached body
+        // or a compressed sidecar.
+        file = _open_files.acquire(path);
+    }
+    if (!file) return false;
+
+    const struct stat& st = file->st;
+    Validators v = validatorsFor(st.st_ino, st.st_size, st.st_mtime);
+    if (isNotModified(req, v)) {
+        OpenFileCache::release(file);
+        queueNotModified(client, v, caching);
+        return true;
+    }
+    if (!ifRangeMatches(req, v)) range.clear();
+
+    ByteRanges ranges;
+    RangeResult result = range.empty() ? RANGE_IGNORE : parseRanges(range, st.st_size, ranges);
+    if (result == RANGE_SATISFIABLE) {
+        queueRanges(client, path, file, ranges, caching);
+        return true;
+    }
+    if (result == RANGE_UNSATISFIABLE) {
+        OpenFileCache::release(file);
+        queueRangeNotSatisfiable(client, st.st_size);
+        return true;
+    }
+
+    client->setResponse(insertHeaders(fileHeaders(path, st, encoding), caching));
+    client->setFileBody(file, 0, static_cast<size_t>(st.st_size));
+    return true;
+}
+
+// Looks a regular file up in the file cache, reading it in on a miss when it
+// is small enough. With an encoding, the file is the precompressed sidecar of
+// `path`, used only while it is at least as new as `path`. Returns NULL when
+// the file is missing (file is NULL) or cannot be cached, in which case the
+// caller gets a held handle from the open file cache in `file`.
+const FileCache::Entry* Server::_cachedFile(const std::string& path, const std::string& encoding, OpenFileCache::File*& file) {
+    file = NULL;
+    std::string name = path + Precompressor::extensionFor(encoding);
+    const FileCache::Entry* cached = _file_cache.lookup(name);
+    if (cached) return cached;
+
+    OpenFileCache::File* opened = _open_files.acquire(name);
+    if (!opened) return NULL;
+    const struct stat& st = opened->st;
+    if (!encoding.empty()) {
+        struct stat source;
+        if (stat(path.c_str(), &source) != 0 || !S_ISREG(source.st_mode) || source.st_mtime > st.st_mtime) {
+            OpenFileCache::release(opened);
+            return NULL;
+        }
+    }
+
+    if (_file_cache.fits(st.st_size)) {
+        std::string body;
+        if (readFile(opened->fd, static_cast<size_t>(st.st_size), body)) {
+            cached = _file_cache.store(name, st, fileHeaders(path, st, encoding), body, encoding.empty() ? "" : path);
+            if (cached) {
+                OpenFileCache::release(opened);
+                return cached;
+            }
+        }
+    }
+    file = opened;
+    return NULL;
+}
+
+// Compresses a generated body in place when the location has gzip on, the
+// type is allowed, the body is big enough and the client takes gzip or
+// deflate. Adds Content-Encoding and Vary (merged into a Vary already in
+// res) to res; the caller still sets Content-Length from the final body.
+void Server::_compressBody(const std::string& accept_encoding, const LocationConfig* loc, const std::string& content_type,
+                           std::string& body, HttpResponse& res) {
+    if (!loc || !loc->gzip) return;
+
+    std::string type = content_type.substr(0, content_type.find(';'));
+    size_t end = type.find_last_not_of(" \t");
+    type = (end == std::string::npos) ? "" : type.substr(0, end + 1);
+    for (size_t i = 0; i < type.length(); ++i) type[i] = std::tolower(type[i]);
+    bool allowed = (type == "text/html");
+    for (size_t i = 0; i < loc->gzip_types.size() && !allowed; ++i) {
+        allowed = (loc->gzip_types[i] == "*" || loc->gzip_types[i] == type);
+    }
+    if (!allowed) return;
+
+    std::string vary = res.getHeader("Vary");
+    std::string lower_vary = vary;
+    for (size_t i = 0; i < lower_vary.length(); ++i) lower_vary[i] = std::tolower(lower_vary[i]);
+    if (vary.empty()) res.addHeader("Vary", "Accept-Encoding");
+    else if (lower_vary.find("accept-encoding") == std::string::npos) res.addHeader("Vary", vary + ", Accept-Encoding");
+    if (body.size() < loc->gzip_min_length) return;
+    std::vector<std::string> encodings = acceptedEncodings(accept_encoding, k_dynamic_encodings, 2);
+    if (encodings.empty()) return;
+
+    std::string compressed;
+    if (!_compressor.compress(body, encodings[0], loc->gzip_comp_level, compressed)
+        || compressed.size() >= body.size()) {
+        return;
+    }
+    body.swap(compressed);
+    res.addHeader("Content-Encoding", encodings[0]);
+}
+
+// Closest existing directory at or above the parent of `path`: creating
+// `path` (or anything leading to it) changes that directory.
+static std::string nearestDirectory(const std::string& path) {
+    std::string dir = path;
+    while (true) {
+        size_t slash = dir.find_last_of('/', dir.length() > 1 ? dir.length() - 2 : 0);
+        if (slash == std::string::npos) return ".";
+        dir.erase(slash == 0 ? 1 : slash);
+        struct stat st;
+        if (stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) return dir;
+        if (dir == "/") return dir;
+    }
+}
+
+// Maps a GET path onto the filesystem the way _handleStatic serves it: the
+// file itself, the .html fallback for extension-less URIs, then the first
+// of the location's index files or the directory itself. Results (misses included) go
+// to the path cache, so repeated requests make no filesystem calls.
+PathCache::Kind Server::_resolvePath(const std::string& file_path, const std::string& uri, const LocationPlan& plan,
+                                     std::string& resolved, bool use_cache) {
+    std::string key = file_path + plan.index_key;
+    if (use_cache) {
+        const PathCache::Entry* cached = _paths.lookup(key);
+        if (cached) {
+            resolved = cached->path;
+            return cached->kind;
+        }
+    }
+
+    std::vector<std::string> dirs;
+    dirs.push_back(nearestDirectory(file_path));
+    PathCache::Kind kind = PathCache::PATH_ABSENT;
+    resolved = file_path;
+
+    // Files are probed through the open file cache, so the fd is already
+    // open when the request goes on to serve it.
+    size_t dot_pos = uri.rfind('.');
+    struct stat st;
+    if (_probeFile(file_path)) {
+        kind = PathCache::PATH_FILE;
+    } else if ((dot_pos == std::string::npos || dot_pos < uri.rfind('/')) && _probeFile(file_path + ".html")) {
+        kind = PathCache::PATH_FILE;
+        resolved = file_path + ".html";
+    } else if (stat(file_path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        dirs.push_back(file_path);
+        std::string dir = file_path + (file_path[file_path.length() - 1] == '/' ? "" : "/");
+        kind = PathCache::PATH_DIRECTORY;
+        for (size_t i = 0; i < plan.indexes.size() && kind == PathCache::PATH_DIRECTORY; ++i) {
+            if (_probeFile(dir + plan.indexes[i])) {
+                kind = PathCache::PATH_FILE;
+                resolved = dir + plan.indexes[i];
+            }
+        }
+    }
+    _paths.store(key, kind, resolved, dirs);
+    return kind;
+}
+
+// True if `path` is a regular file.
+bool Server::_probeFile(const std::string& path) {
+    OpenFileCache::File* file = _open_files.acquire(path);
+    OpenFileCache::release(file);
+    return file != NULL;
+}
+
+void Server::_handleInotify(int, ClientConnection*) {
+    _paths.handleInotify();
+}
+
+// Lists a directory for an autoindex location. A page rendered before for
+// the directory's current version is queued right away and true returned;
+// otherwise a job is started and finished by _advanceListings().
+bool Server::_listDirectory(ClientConnection* client, const std::string& dir, const std::string& uri,
+                            const LocationConfig* loc) {
+    const HttpRequest& req = client->getRequest();
+    struct stat st;
+    time_t mtime = (stat(dir.c_str(), &st) == 0) ? st.st_mtime : 0;
+    Autoindex::Query query = Autoindex::Query::parse(req.getQueryString(), loc->autoindex_page_size);
+
+    const std::string* page = _autoindex.findPage(dir, mtime, query);
+    if (page) {
+        _queueListing(client, *page, loc, req.getHeader("Accept-Encoding"));
+        return true;
+    }
+
+    Listing listing;
+    listing.job = _autoindex.start(dir, mtime, uri, query);
+    listing.loc = loc;
+    listing.accept_encoding = req.getHeader("Accept-Encoding");
+    _listings[client->getFd()] = listing;
+    return false;
+}
+
+// Gives every pending listing one bounded batch of work.
+void Server::_advanceListings() {
+    std::map<int, Listing>::iterator it = _listings.begin();
+    while (it != _listings.end()) {
+        if (!it->second.job->step(k_autoindex_batch)) {
+            ++it;
+            continue;
+        }
+        ClientConnection* client = _slotOf(it->first).owner;
+        Listing listing = it->second;
+        _listings.erase(it++);
+        if (listing.job->failed()) {
+            _sendErrorResponse(client, 403, "Forbidden", listing.loc);
+        } else {
+            _queueListing(client, listing.job->html(), listing.loc, listing.accept_encoding);
+            _queueWrite(client);
+        }
+        delete listing.job;
     }
 }
 
+void Server::_queueListing(ClientConnection* client, const std::string& html, const LocationConfig* loc,
+                           const std::string& accept_encoding) {
+    HttpResponse res;
+    res.setStatusCode(200, "OK");
+    res.addHeader("Content-Type", "text/html");
+    std::string body = html;
+    _compressBody(accept_encoding, loc, "text/html", body, res);
+    std::stringstream ss_len; ss_len << body.length();
+    res.addHeader("Content-Length", ss_len.str());
+    res.setBody(body);
+    client->setResponse(res.toString());
+}
+
+// Builds the sidecars of every gzip_static location in the background when
+// gzip_static_build is on. Files are found under root + location path, the
+// same way requests are resolved.
+void Server::_startPrecompression() const {
+    if (!_config.getGzipStaticBuild()) return;
+
+    std::vector<std::string> roots;
+    const std::vector<LocationConfig*>& locations = _config.getLocations();
+    for (size_t i = 0; i < locations.size(); ++i) {
+        if (!locations[i]->gzip_static) continue;
+        // Regex locations name no directory to walk.
+        if (locations[i]->match == LocationConfig::MATCH_REGEX || locations[i]->match == LocationConfig::MATCH_REGEX_ICASE) continue;
+        std::string root = locations[i]->root.empty() ? _config.getRoot() : locations[i]->root;
+        roots.push_back(root + locations[i]->path);
+    }
+    Precompressor::start(roots, _config.getGzipStaticThreads());
+}
+
+// Hits as a fraction of all lookups, 0 before the first one.
+static double hitRate(unsigned long hits, unsigned long misses) {
+    return (hits + misses) ? static_cast<double>(hits) / (hits + misses) : 0.0;
+}
+
+std::string Server::_statsBody() const {
+    std::stringstream ss;
+    ss << "connections " << _client_count << "\n"
+       << "pending_bytes " << ClientConnection::getPendingBytes() << "\n"
+       << "file_cache_hits " << _file_cache.getHits() << "\n"
+       << "file_cache_misses " << _file_cache.getMisses() << "\n"
+       << "file_cache_evictions " << _file_cache.getEvictions() << "\n"
+       << "file_cache_entries " << _file_cache.getEntryCount() << "\n"
+       << "file_cache_bytes " << _file_cache.getBytes() << "\n"
+       << "gzip_cache_hits " << _compressor.getHits() << "\n"
+       << "gzip_cache_misses " << _compressor.getMisses() << "\n"
+       << "gzip_cache_evictions " << _compressor.getEvictions() << "\n"
+       << "gzip_cache_bytes " << _compressor.getBytes() << "\n"
+       << "open_file_cache_hits " << _open_files.getHits() << "\n"
+       << "open_file_cache_misses " << _open_files.getMisses() << "\n"
+       << "open_file_cache_hit_rate " << hitRate(_open_files.getHits(), _open_files.getMisses()) << "\n"
+       << "open_file_cache_entries " << _open_files.getEntryCount() << "\n"
+       << "path_cache_hits " << _paths.getHits() << "\n"
+       << "path_cache_misses " << _paths.getMisses() << "\n"
+       << "path_cache_invalidations " << _paths.getInvalidations() << "\n"
+       << "path_cache_entries " << _paths.getEntryCount() << "\n"
+       << "autoindex_cache_hits " << _autoindex.getHits() << "\n"
+       << "autoindex_cache_misses " << _autoindex.getMisses() << "\n"
+       << "autoindex_pending " << _listings.size() << "\n";
+    return ss.str();
+}
+
+// Builds argv and envp before fork(): the process may run threads (the
+// gzip_static precompression), so the child only makes async-signal-safe
+// calls between fork() and execve().
 void Server::_executeCgi(ClientConnection* client, const LocationConfig* loc) {
+    const HttpRequest& req = client->getRequest();
+
+    std::string script_name_uri = req.getUri();
+    size_t query_pos = script_name_uri.find('?');
+    if (query_pos != std::string::npos) {
+        script_name_uri = script_name_uri.substr(0, query_pos);
+    }
+
+    char cwd[1024];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+        perror("getcwd failed");
+        _sendErrorResponse(client, 500, "Internal Server Error: getcwd() failed", loc);
+        return;
+    }
+    std::string script_filename = std::string(cwd) + script_name_uri;
+
+    std::vector<std::string> argv_str;
+    argv_str.push_back(loc->cgi_path);
+    argv_str.push_back(script_filename);
+
+    std::vector<std::string> env_vars_str;
+    env_vars_str.push_back("REQUEST_METHOD=" + req.getMethod());
+    env_vars_str.push_back("SCRIPT_FILENAME=" + script_filename);
+    env_vars_str.push_back("SCRIPT_NAME=" + script_name_uri);
+    env_vars_str.push_back("QUERY_STRING=" + req.getQueryString());
+    env_vars_str.push_back("SERVER_PROTOCOL=HTTP/1.1");
+    env_vars_str.push_back("SERVER_SOFTWARE=webserv/1.0");
+    env_vars_str.push_back("GATEWAY_INTERFACE=CGI/1.1");
+    if (req.getMethod() == "POST") {
+        env_vars_str.push_back("CONTENT_LENGTH=" + req.getHeader("Content-Length"));
+        env_vars_str.push_back("CONTENT_TYPE=" + req.getHeader("Content-Type"));
+    }
+
+    std::vector<char*> argv_c;
+    for (size_t i = 0; i < argv_str.size(); ++i) argv_c.push_back(const_cast<char*>(argv_str[i].c_str()));
+    argv_c.push_back(NULL);
+    std::vector<char*> envp_c;
+    for (size_t i = 0; i < env_vars_str.size(); ++i) envp_c.push_back(const_cast<char*>(env_vars_str[i].c_str()));
+    envp_c.push_back(NULL);
+
     int cgi_stdout_pipe[2]; // Pipe for CGI to write its stdout to
     int cgi_stdin_pipe[2];  // Pipe for server to write request body to CGI's stdin
 
@@ -528,72 +1897,20 @@ void Server::_executeCgi(ClientConnection* client, const LocationConfig* loc) {
         close(cgi_stdout_pipe[0]); // Child doesn't read from stdout pipe
         close(cgi_stdin_pipe[1]);  // Child doesn't write to stdin pipe
 
-        // Redirect child's stdin to be the read end of the stdin pipe
-        if (dup2(cgi_stdin_pipe[0], STDIN_FILENO) == -1) {
-            perror("dup2 STDIN_FILENO failed"); exit(EXIT_FAILURE);
-        }
-        // Redirect child's stdout and stderr to be the write end of the stdout pipe
-        if (dup2(cgi_stdout_pipe[1], STDOUT_FILENO) == -1) {
-            perror("dup2 STDOUT_FILENO failed"); exit(EXIT_FAILURE);
-        }
-        if (dup2(cgi_stdout_pipe[1], STDERR_FILENO) == -1) {
-            perror("dup2 STDERR_FILENO failed"); exit(EXIT_FAILURE);
+        // Redirect stdin to the stdin pipe, stdout and stderr to the stdout pipe
+        if (dup2(cgi_stdin_pipe[0], STDIN_FILENO) == -1
+            || dup2(cgi_stdout_pipe[1], STDOUT_FILENO) == -1
+            || dup2(cgi_stdout_pipe[1], STDERR_FILENO) == -1) {
+            _exit(EXIT_FAILURE);
         }
         close(cgi_stdout_pipe[1]);
-        const HttpRequest& req = client->getRequest();
-
-        std::string root = _config.getRoot();
-        if (loc && !loc->root.empty()) {
-            root = loc->root;
-        }
-
-        std::string script_name_uri = req.getUri();
-        size_t query_pos = script_name_uri.find('?');
-        if (query_pos != std::string::npos) {
-            script_name_uri = script_name_uri.substr(0, query_pos);
-        }
-
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) == NULL) {
-            perror("getcwd failed"); exit(EXIT_FAILURE);
-        }
-        std::string script_filename = std::string(cwd) + script_name_uri;
 
-        char** argv_c = new char*[3];
-        argv_c[0] = new char[loc->cgi_path.length() + 1];
-        strcpy(argv_c[0], loc->cgi_path.c_str());
-        argv_c[1] = new char[script_filename.length() + 1];
-        strcpy(argv_c[1], script_filename.c_str());
-        argv_c[2] = NULL;
+        execve(argv_c[0], &argv_c[0], &envp_c[0]);
 
-        std::vector<std::string> env_vars_str;
-        env_vars_str.push_back("REQUEST_METHOD=" + req.getMethod());
-        env_vars_str.push_back("SCRIPT_FILENAME=" + script_filename);
-        env_vars_str.push_back("SCRIPT_NAME=" + script_name_uri);
-        env_vars_str.push_back("QUERY_STRING=" + req.getQueryString());
-        env_vars_str.push_back("SERVER_PROTOCOL=HTTP/1.1");
-        env_vars_str.push_back("SERVER_SOFTWARE=webserv/1.0");
-        env_vars_str.push_back("GATEWAY_INTERFACE=CGI/1.1");
-        if (req.getMethod() == "POST") {
-            env_vars_str.push_back("CONTENT_LENGTH=" + req.getHeader("Content-Length"));
-            env_vars_str.push_back("CONTENT_TYPE=" + req.getHeader("Content-Type"));
-        }
-
-        char** envp_c = new char*[env_vars_str.size() + 1];
-        for (size_t i = 0; i < env_vars_str.size(); ++i) {
-            envp_c[i] = new char[env_vars_str[i].length() + 1];
-            strcpy(envp_c[i], env_vars_str[i].c_str());
-        }
-        envp_c[env_vars_str.size()] = NULL;
-
-        execve(argv_c[0], argv_c, envp_c);
-
-        perror("execve failed");
-        for (size_t i = 0; i < env_vars_str.size(); ++i) delete[] envp_c[i];
-        delete[] envp_c;
-        for (size_t i = 0; i < 2; ++i) delete[] argv_c[i];
-        delete[] argv_c;
-        exit(EXIT_FAILURE);
+        static const char k_exec_failed[] = "execve failed\n"; // Seen by _handleCgiRead()
+        ssize_t ignored = write(STDERR_FILENO, k_exec_failed, sizeof(k_exec_failed) - 1);
+        (void)ignored;
+        _exit(EXIT_FAILURE);
 
     } else { // Parent Process
         close(cgi_stdout_pipe[1]); // Parent doesn't write to CGI's stdout
@@ -617,47 +1934,25 @@ void Server::_executeCgi(ClientConnection* client, const LocationConfig* loc) {
 
         client->setCgiPipeFd(cgi_stdout_pipe[0]);
         client->setCgiPid(pid);
-        _pipe_to_client_map[cgi_stdout_pipe[0]] = client->getFd();
-
-        FD_SET(cgi_stdout_pipe[0], &_master_set);
-        close(cgi_stdin_pipe[0]);
+        client->setCgiLocation(loc);
+        _setSlot(cgi_stdout_pipe[0], FD_CGI_STDOUT, client);
+        _poller->add(cgi_stdout_pipe[0], Poller::EVENT_READ);
 
-        const HttpRequest& req = client->getRequest();
-
-        std::string root = _config.getRoot();
         if (req.getMethod() == "POST" && !req.getBody().empty()) {
-            _cgi_stdin_pipe_to_client_map[cgi_stdin_pipe[1]] = client->getFd();
-            FD_SET(cgi_stdin_pipe[1], &_write_fds);
-            if (cgi_stdin_pipe[1] > _max_fd) _max_fd = cgi_stdin_pipe[1];
+            client->setCgiStdinFd(cgi_stdin_pipe[1]);
+            _setSlot(cgi_stdin_pipe[1], FD_CGI_STDIN, client);
+            _poller->add(cgi_stdin_pipe[1], Poller::EVENT_WRITE);
         } else {
             close(cgi_stdin_pipe[1]); // No body to write, close it
         }
     }
 }
 
-void Server::_handleCgiRead(int pipe_fd) {
+void Server::_handleCgiRead(int pipe_fd, ClientConnection* client) {
     char buffer[4096];
     ssize_t bytes_read = read(pipe_fd, buffer, sizeof(buffer) - 1);
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
 
-    int client_fd = _pipe_to_client_map[pipe_fd];
-    if (_clients.find(client_fd) == _clients.end()) {
-        // Client connection already closed, clean up CGI process
-        pid_t cgi_pid = 0;
-        for (std::map<int, ClientConnection*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-            if (it->second->getCgiPipeFd() == pipe_fd) {
-                cgi_pid = it->second->getCgiPid();
-                break;
-            }
-        }
-        if (cgi_pid > 0) {
-            waitpid(cgi_pid, NULL, 0); // Wait for child
-        }
-        close(pipe_fd);
-        FD_CLR(pipe_fd, &_master_set);
-        _pipe_to_client_map.erase(pipe_fd);
-        return;
-    }
-    ClientConnection* client = _clients[client_fd];
     const LocationConfig* loc = client->getCgiLocation(); // Retrieve location config
 
     if (bytes_read > 0) {
@@ -680,13 +1975,11 @@ void Server::_handleCgiRead(int pipe_fd) {
         {
             std::cerr << "_handleCgiRead: Detected child process error in CGI output. Sending 500." << std::endl; fflush(stderr);
             _sendErrorResponse(client, 500, "Internal Server Error: CGI script execution failed", loc);
+            client->replaceParser();
             // Cleanup CGI process
             waitpid(client->getCgiPid(), NULL, 0); // Wait for child process to finish
-            close(pipe_fd);
-            FD_CLR(pipe_fd, &_master_set);
-            _pipe_to_client_map.erase(pipe_fd);
+            _closeCgiPipe(pipe_fd);
             client->setCgiPid(0);
-            client->setCgiPipeFd(-1);
             return; // Important: return after sending error
         }
         // --- END NEW ERROR DETECTION LOGIC ---
@@ -702,6 +1995,8 @@ void Server::_handleCgiRead(int pipe_fd) {
         }
 
         std::string final_body;
+        std::string content_type;
+        bool cgi_encoded = false;
 
         if (header_end == std::string::npos) {
             std::cerr << "_handleCgiRead: No CGI headers found." << std::endl; fflush(stderr);
@@ -715,9 +2010,9 @@ void Server::_handleCgiRead(int pipe_fd) {
 
             std::stringstream ss_headers(cgi_headers_str);
             std::string line;
-            while (std::getline(ss_headers, line, '\r')) { // Read line by line, split by \r
+            while (std::getline(ss_headers, line)) { // CGIs may end header lines with \n or \r\n
+                if (!line.empty() && line[line.length() - 1] == '\r') line.erase(line.length() - 1);
                 if (line.empty()) continue;
-                if (line[0] == '\n') line = line.substr(1); // Remove leading \n if present
                 size_t colon_pos = line.find(":");
                 if (colon_pos != std::string::npos) {
                     std::string key = line.substr(0, colon_pos);
@@ -727,11 +2022,24 @@ void Server::_handleCgiRead(int pipe_fd) {
                     if (first_char != std::string::npos) {
                         value = value.substr(first_char);
                     }
-                    res.addHeader(key, value);
+                    std::string lower_key = key;
+                    for (size_t i = 0; i < lower_key.length(); ++i) lower_key[i] = std::tolower(lower_key[i]);
+                    // The length is set below, after compression; Vary is
+                    // kept under one name so _compressBody() can extend it.
+                    if (lower_key == "content-length") continue;
+                    if (lower_key == "vary") {
+                        std::string vary = res.getHeader("Vary");
+                        res.addHeader("Vary", vary.empty() ? value : vary + ", " + value);
+                    } else {
+                        res.addHeader(key, value);
+                    }
+                    if (lower_key == "content-type") content_type = value;
+                    if (lower_key == "content-encoding") cgi_encoded = true;
                     std::cerr << "_handleCgiRead: Added Header: " << key << ": " << value << std::endl; fflush(stderr);
                 }
             }
         }
+        if (!cgi_encoded) _compressBody(client->getRequest().getHeader("Accept-Encoding"), loc, content_type, final_body, res);
         res.setBody(final_body);
         std::stringstream ss_len;
         ss_len << final_body.length();
@@ -739,34 +2047,21 @@ void Server::_handleCgiRead(int pipe_fd) {
         std::cerr << "_handleCgiRead: Final Body Length: " << final_body.length() << std::endl; fflush(stderr);
 
         client->setResponse(res.toString());
-        FD_SET(client_fd, &_write_fds);
+        _finishRequest(client);
 
         // Cleanup CGI process
         waitpid(client->getCgiPid(), NULL, 0); // Wait for child process to finish
-        close(pipe_fd);
-        FD_CLR(pipe_fd, &_master_set);
-        _pipe_to_client_map.erase(pipe_fd);
+        _closeCgiPipe(pipe_fd);
         client->setCgiPid(0);
-        client->setCgiPipeFd(-1);
     }
 }
 
-void Server::_handleCgiWrite(int pipe_fd) {
-    int client_fd = _cgi_stdin_pipe_to_client_map[pipe_fd];
-    if (_clients.find(client_fd) == _clients.end()) {
-        close(pipe_fd);
-        FD_CLR(pipe_fd, &_write_fds);
-        _cgi_stdin_pipe_to_client_map.erase(pipe_fd);
-        return;
-    }
-    ClientConnection* client = _clients[client_fd];
+void Server::_handleCgiWrite(int pipe_fd, ClientConnection* client) {
     const HttpRequest& req = client->getRequest();
     const std::string& body = req.getBody();
 
     if (body.empty()) {
-        close(pipe_fd);
-        FD_CLR(pipe_fd, &_write_fds);
-        _cgi_stdin_pipe_to_client_map.erase(pipe_fd);
+        _closeCgiPipe(pipe_fd);
         return;
     }
 
@@ -775,92 +2070,89 @@ void Server::_handleCgiWrite(int pipe_fd) {
     if (bytes_written < 0) {
         // Error handling: could be EAGAIN or a real error
         std::cerr << "CGI stdin write error" << std::endl; fflush(stderr);
-        close(pipe_fd);
-        FD_CLR(pipe_fd, &_write_fds);
-        _cgi_stdin_pipe_to_client_map.erase(pipe_fd);
+        _closeCgiPipe(pipe_fd);
         return;
     }
 
     // In a more robust implementation, you would handle partial writes.
     // For now, we assume the whole body is written at once.
     std::cout << "Wrote " << bytes_written << " bytes to CGI stdin" << std::endl;
-    close(pipe_fd);
-    FD_CLR(pipe_fd, &_write_fds);
-    _cgi_stdin_pipe_to_client_map.erase(pipe_fd);
+    _closeCgiPipe(pipe_fd);
 }
 
-void Server::_handleClientWrite(int client_fd) {
-    if (_clients.find(client_fd) == _clients.end()) {
-        FD_CLR(client_fd, &_write_fds); return;
-    }
-    ClientConnection* client = _clients[client_fd];
+void Server::_handleClientWrite(int client_fd, ClientConnection* client) {
     const std::string& response = client->getResponseBuffer();
 
-    if (response.empty()) {
+    if (response.empty() && client->getFileRemaining() == 0 && client->getSharedRemaining() == 0) {
         std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: Response buffer is empty." << std::endl; fflush(stderr);
-        FD_CLR(client_fd, &_write_fds); return;
+        _poller->setWriteInterest(client_fd, false); return;
     }
 
-    std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: Attempting to send " << response.length() << " bytes." << std::endl; fflush(stderr);
-    ssize_t bytes_sent = send(client_fd, response.c_str(), response.length(), 0);
-
-    if (bytes_sent < 0) {
-        std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: send() failed with error: " << strerror(errno) << std::endl; fflush(stderr);
-        close(client_fd); FD_CLR(client_fd, &_master_set); FD_CLR(client_fd, &_write_fds); delete _clients[client_fd]; _clients.erase(client_fd); return;
+    if (client->getSharedRemaining() > 0) {
+        ssize_t bytes_sent = client->sendSharedResponse();
+        if (bytes_sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: send() failed with error: " << strerror(errno) << std::endl; fflush(stderr);
+            _closeClient(client_fd); return;
+        }
+        if (client->getSharedRemaining() > 0) {
+            _armTimer(client, ClientConnection::TIMEOUT_SEND);
+            return;
+        }
     }
 
-    if (static_cast<size_t>(bytes_sent) < response.length()) {
-        std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: Sent " << bytes_sent << " bytes, " << (response.length() - bytes_sent) << " remaining." << std::endl; fflush(stderr);
-        client->setResponse(response.substr(bytes_sent));
-    } else {
-        std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: All " << bytes_sent << " bytes sent successfully." << std::endl; fflush(stderr);
-        client->clearResponseBuffer();
-        FD_CLR(client_fd, &_write_fds);
-        // Do NOT close the client_fd here. Keep it open for subsequent requests.
-        // The client connection will be closed by _handleClientData if readRequest() returns 0 or an error occurs.
-    }
-}
+    if (!response.empty()) {
+        std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: Attempting to send " << response.length() << " bytes." << std::endl; fflush(stderr);
+        ssize_t bytes_sent = send(client_fd, response.c_str(), response.length(), 0);
 
-void Server::_sendErrorResponse(ClientConnection* client, int code, const std::string& message, const LocationConfig* loc) {
-    HttpResponse res;
-    res.setStatusCode(code, message);
-    res.addHeader("Content-Type", "text/html");
+        if (bytes_sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: send() failed with error: " << strerror(errno) << std::endl; fflush(stderr);
+            _closeClient(client_fd); return;
+        }
 
-    std::string body;
-    std::string custom_error_page_path;
-
-    // 1. Check for location-specific error page
-    if (loc && loc->error_pages.count(code)) {
-        custom_error_page_path = loc->error_pages.at(code);
-    } 
-    // 2. If not found, check for server-level error page
-    else if (_config.getErrorPages().count(code)) {
-        custom_error_page_path = _config.getErrorPages().at(code);
-    }
-
-    if (!custom_error_page_path.empty()) {
-        std::string full_path = _config.getRoot() + custom_error_page_path;
-        std::ifstream custom_file(full_path.c_str());
-        if (custom_file.is_open()) {
-            std::stringstream buffer;
-            buffer << custom_file.rdbuf();
-            body = buffer.str();
-        } else {
-            std::cerr << "Warning: Custom error page not found or could not be opened: " << full_path << std::endl; fflush(stderr);
+        if (static_cast<size_t>(bytes_sent) < response.length()) {
+            std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: Sent " << bytes_sent << " bytes, " << (response.length() - bytes_sent) << " remaining." << std::endl; fflush(stderr);
+            client->setResponse(response.substr(bytes_sent));
+            _armTimer(client, ClientConnection::TIMEOUT_SEND);
+            return;
         }
+        client->clearResponseBuffer();
     }
 
-    if (body.empty()) { // 3. Fallback to generic HTML
-        std::stringstream body_ss;
-        body_ss << "<html><body><h1>" << code << " " << message << "</h1></body></html>";
-        body = body_ss.str();
+    if (client->getFileRemaining() > 0) {
+        ssize_t bytes_sent = client->sendFileBody();
+        if (bytes_sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: sendfile() failed with error: " << strerror(errno) << std::endl; fflush(stderr);
+            _closeClient(client_fd); return;
+        }
+        if (client->getFileRemaining() > 0) {
+            _armTimer(client, ClientConnection::TIMEOUT_SEND);
+            return;
+        }
     }
 
-    std::stringstream len_ss;
-    len_ss << body.length();
-    res.addHeader("Content-Length", len_ss.str());
-    res.setBody(body);
+    std::cerr << "DEBUG: Client " << client_fd << " _handleClientWrite: Response sent successfully." << std::endl; fflush(stderr);
+    if (client->shouldCloseAfterWrite()) {
+        _closeClient(client_fd);
+        return;
+    }
+    _poller->setWriteInterest(client_fd, false);
+    _armTimer(client, ClientConnection::TIMEOUT_KEEPALIVE);
+    // Do NOT close the client_fd here. Keep it open for subsequent requests.
+    // The client connection will be closed by _handleClientData if readRequest() returns 0 or an error occurs.
+    if (client->hasBufferedInput()) {
+        _processInput(client); // Pipelined requests that arrived meanwhile
+    }
+}
 
-    client->setResponse(res.toString());
-    FD_SET(client->getFd(), &_write_fds);
+// Queues the prebuilt error reply for the location: no parsing, file read
+// or serialization happens per request, only a reference handoff.
+void Server::_sendErrorResponse(ClientConnection* client, int code, const std::string& message, const LocationConfig* loc) {
+    if (message != ErrorPages::reasonPhrase(code)) {
+        std::cerr << "Error " << code << ": " << message << std::endl; fflush(stderr);
+    }
+    client->setSharedResponse(_error_pages.find(loc, code, client->shouldCloseAfterWrite()));
+    _queueWrite(client);
 }
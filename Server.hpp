@@ -1,11 +1,22 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
-#include <sys/select.h>
+#include <sys/types.h>
+#include <deque>
 #include <map>
 #include <string>
 #include "ConfigParser.hpp"
 #include "ClientConnection.hpp"
+#include "Poller.hpp"
+#include "TimerWheel.hpp"
+#include "FileCache.hpp"
+#include "ResponseCompressor.hpp"
+#include "Autoindex.hpp"
+#include "PathCache.hpp"
+#include "OpenFileCache.hpp"
+#include "ErrorPages.hpp"
+
+std::string getMimeType(const std::string& filePath);
 
 class Server {
 public:
@@ -14,24 +25,147 @@ public:
 
     void run();
 
+    // Request methods as dispatched through a location's plan
+    enum Method {
+        METHOD_GET, // HEAD is served like GET, without the body
+        METHOD_POST,
+        METHOD_DELETE,
+        METHOD_PUT,
+        METHOD_OTHER,
+        METHOD_COUNT
+    };
+
 private:
-    void _acceptNewConnection(int listening_fd);
-    void _handleClientData(int client_fd);
-    void _handleClientWrite(int client_fd);
-    void _handleCgiRead(int pipe_fd);
+    // What a descriptor in the dispatch table belongs to
+    enum FdType {
+        FD_NONE,
+        FD_LISTEN,
+        FD_CLIENT,
+        FD_CGI_STDOUT,
+        FD_CGI_STDIN,
+        FD_INOTIFY,
+        FD_LINGER, // Shed connection whose request is drained before close
+        FD_TYPE_COUNT
+    };
+
+    struct FdSlot {
+        FdType type;
+        ClientConnection* owner; // NULL for listening sockets
+
+        FdSlot() : type(FD_NONE), owner(NULL) {}
+    };
+
+    // A directory listing being rendered for a client
+    struct Listing {
+        Autoindex::Job* job;
+        const LocationConfig* loc;
+        std::string accept_encoding;
+    };
+
+    struct LocationPlan;
+    typedef void (Server::*RequestHandler)(ClientConnection* client, const LocationPlan& plan);
+
+    // A location compiled at startup into what its requests need: the
+    // handler for each method (405, redirect, stats, static, upload, ...),
+    // the methods routed to CGI when the URI ends in cgi_ext, and the
+    // resolved root, upload directory and index list.
+    struct LocationPlan {
+        const LocationConfig* loc; // NULL for requests no location matches
+        RequestHandler handlers[METHOD_COUNT];
+        unsigned int cgi_methods; // Bitmask of Method
+        std::string cgi_ext;
+        std::string root;
+        std::string upload_dir; // With a trailing slash, empty without uploads
+        std::vector<std::string> indexes;
+        std::string index_key; // The index list as a path cache key suffix
+        SharedBuffer* redirect; // Prebuilt 301, NULL without a redirect
+        SharedBuffer* redirect_close; // The same with "Connection: close"
+    };
+
+    typedef void (Server::*FdHandler)(int fd, ClientConnection* owner);
+    static const FdHandler _readHandlers[FD_TYPE_COUNT];
+    static const FdHandler _writeHandlers[FD_TYPE_COUNT];
+
+    FdSlot _slotOf(int fd) const;
+    void _setSlot(int fd, FdType type, ClientConnection* owner);
+    void _clearSlot(int fd);
+
+    void _setupEventLoop();
+    void _eventLoop();
+    void _runMaster();
+    pid_t _spawnWorker(int worker_id);
+    void _acceptNewConnection(int listening_fd, ClientConnection*);
+    bool _isOverloaded() const;
+    void _shedConnection(int client_fd);
+    void _pauseAccept(bool paused);
+    void _handleLingerRead(int fd, ClientConnection*);
+    void _closeLingering(int fd);
+    void _handleClientData(int client_fd, ClientConnection* client);
+    bool _isBusy(ClientConnection* client) const;
+    void _processInput(ClientConnection* client);
+    bool _admitBody(ClientConnection* client, const LocationPlan& plan, RequestHandler handler);
+    void _rejectBody(ClientConnection* client, int code, const std::string& message, const LocationConfig* loc);
+    bool _beginPut(ClientConnection* client, const LocationPlan& plan);
+    bool _receivePut(ClientConnection* client);
+    void _pauseReading(int client_fd, bool paused);
+    void _compilePlans();
+    void _compilePlan(LocationPlan& plan, const LocationConfig* loc);
+    const LocationPlan& _planFor(const LocationConfig* loc) const;
+    RequestHandler _handlerFor(const HttpRequest& req, const LocationPlan& plan) const;
+    void _dispatchRequest(ClientConnection* client);
+    void _finishRequest(ClientConnection* client);
+    void _handleNotAllowed(ClientConnection* client, const LocationPlan& plan);
+    void _handleNotImplemented(ClientConnection* client, const LocationPlan& plan);
+    void _handleRedirect(ClientConnection* client, const LocationPlan& plan);
+    void _handleStats(ClientConnection* client, const LocationPlan& plan);
+    void _handleCgi(ClientConnection* client, const LocationPlan& plan);
+    void _handleStatic(ClientConnection* client, const LocationPlan& plan);
+    void _handleUpload(ClientConnection* client, const LocationPlan& plan);
+    void _handleDelete(ClientConnection* client, const LocationPlan& plan);
+    void _handlePut(ClientConnection* client, const LocationPlan& plan);
+    void _handleClientWrite(int client_fd, ClientConnection* client);
+    void _handleCgiRead(int pipe_fd, ClientConnection* client);
+    bool _serveFile(ClientConnection* client, const std::string& path);
+    const FileCache::Entry* _cachedFile(const std::string& path, const std::string& encoding, OpenFileCache::File*& file);
+    void _startPrecompression() const;
+    void _compressBody(const std::string& accept_encoding, const LocationConfig* loc, const std::string& content_type,
+                       std::string& body, HttpResponse& res);
+    PathCache::Kind _resolvePath(const std::string& file_path, const std::string& uri, const LocationPlan& plan,
+                                 std::string& resolved, bool use_cache);
+    bool _probeFile(const std::string& path);
+    void _handleInotify(int fd, ClientConnection*);
+    bool _listDirectory(ClientConnection* client, const std::string& dir, const std::string& uri, const LocationConfig* loc);
+    void _advanceListings();
+    void _queueListing(ClientConnection* client, const std::string& html, const LocationConfig* loc,
+                       const std::string& accept_encoding);
+    std::string _statsBody() const;
     void _executeCgi(ClientConnection* client, const LocationConfig* loc);
-    void _handleCgiWrite(int pipe_fd);
+    void _handleCgiWrite(int pipe_fd, ClientConnection* client);
+    void _closeCgiPipe(int pipe_fd);
+    void _closeClient(int client_fd);
+    void _queueWrite(ClientConnection* client);
+    long _timeoutFor(ClientConnection::TimeoutKind kind, const LocationConfig* loc) const;
+    void _armTimer(ClientConnection* client, ClientConnection::TimeoutKind kind);
+    void _handleTimeouts();
     void _sendErrorResponse(ClientConnection* client, int code, const std::string& message, const LocationConfig* loc);
     int _setupServerSocket(int port); // Helper to setup a single socket
 
     const ConfigParser& _config;
     std::vector<int> _listen_fds; // Changed to vector
-    int _max_fd;
-    fd_set _master_set;
-    fd_set _write_fds;
-    std::map<int, ClientConnection*> _clients;
-    std::map<int, int> _pipe_to_client_map; // Maps CGI stdout pipe READ_END to client_fd
-    std::map<int, int> _cgi_stdin_pipe_to_client_map; // Maps CGI stdin pipe WRITE_END to client_fd
+    Poller* _poller;
+    TimerWheel _timers;
+    FileCache _file_cache;
+    ResponseCompressor _compressor;
+    Autoindex _autoindex;
+    PathCache _paths;
+    OpenFileCache _open_files;
+    ErrorPages _error_pages;
+    std::vector<LocationPlan> _plans; // [0] for no location, then by LocationConfig::id
+    std::map<int, Listing> _listings; // Pending directory listings by client fd
+    std::vector<FdSlot> _fd_table; // Indexed by fd: listeners, clients and CGI pipes
+    size_t _client_count;
+    std::deque<std::pair<int, unsigned long> > _lingering; // Shed fds and their close deadline, oldest first
+    unsigned long _accept_paused_at; // Monotonic ms when fd exhaustion stopped accept(), 0 if accepting
 };
 
 #endif
@@ -0,0 +1,18 @@
+#include "SharedBuffer.hpp"
+
+SharedBuffer::SharedBuffer(const std::string& data) : _data(data), _refs(1) {}
+
+SharedBuffer::~SharedBuffer() {}
+
+SharedBuffer* SharedBuffer::retain() {
+    ++_refs;
+    return this;
+}
+
+void SharedBuffer::release(SharedBuffer* buffer) {
+    if (buffer && --buffer->_refs == 0) delete buffer;
+}
+
+const std::string& SharedBuffer::data() const {
+    return _data;
+}
@@ -0,0 +1,26 @@
+#ifndef SHARED_BUFFER_HPP
+#define SHARED_BUFFER_HPP
+
+#include <string>
+
+// Immutable bytes shared by reference count, so one prebuilt response can
+// be queued on many connections without a copy each. The creator holds
+// the first reference; the buffer is freed when the last one is released.
+class SharedBuffer {
+public:
+    explicit SharedBuffer(const std::string& data);
+
+    SharedBuffer* retain();
+    static void release(SharedBuffer* buffer);
+    const std::string& data() const;
+
+private:
+    SharedBuffer(const SharedBuffer&);
+    SharedBuffer& operator=(const SharedBuffer&);
+    ~SharedBuffer();
+
+    std::string _data;
+    unsigned int _refs;
+};
+
+#endif // SHARED_BUFFER_HPP
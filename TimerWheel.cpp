@@ -0,0 +1,145 @@
+#include "TimerWheel.hpp"
+#include <time.h>
+
+TimerWheel::Timer::Timer() : prev(NULL), next(NULL), expires(0), fd(-1) {}
+
+bool TimerWheel::Timer::isActive() const {
+    return next != NULL;
+}
+
+TimerWheel::TimerWheel(unsigned long tick_ms) :
+    _current(0),
+    _base_ms(nowMs()),
+    _tick_ms(tick_ms ? tick_ms : 1),
+    _count(0)
+{
+    for (int i = 0; i < L0_SIZE; ++i) {
+        _level0[i].prev = _level0[i].next = &_level0[i];
+    }
+    for (int i = 0; i < L1_SIZE; ++i) {
+        _level1[i].prev = _level1[i].next = &_level1[i];
+    }
+}
+
+TimerWheel::~TimerWheel() {}
+
+unsigned long TimerWheel::nowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long>(ts.tv_sec) * 1000UL + static_cast<unsigned long>(ts.tv_nsec / 1000000);
+}
+
+unsigned long TimerWheel::_tickOf(unsigned long now_ms) const {
+    if (now_ms < _base_ms) return 0;
+    return (now_ms - _base_ms) / _tick_ms;
+}
+
+void TimerWheel::schedule(Timer* timer, unsigned long delay_ms) {
+    if (timer->isActive()) _unlink(timer);
+    else ++_count;
+    // Round up, plus one tick for the part of the current tick that has
+    // already elapsed, so a timer may fire late by one tick but never early.
+    unsigned long ticks = (delay_ms + _tick_ms - 1) / _tick_ms + 1;
+    unsigned long now_tick = _tickOf(nowMs());
+    if (now_tick < _current) now_tick = _current;
+    timer->expires = now_tick + ticks;
+    _link(timer);
+}
+
+void TimerWheel::cancel(Timer* timer) {
+    if (!timer->isActive()) return;
+    _unlink(timer);
+    --_count;
+}
+
+void TimerWheel::_link(Timer* timer) {
+    unsigned long expires = timer->expires;
+    Timer* head;
+
+    if (expires < _current) {
+        head = &_level0[_current & L0_MASK];
+    } else if (expires - _current < static_cast<unsigned long>(L0_SIZE)) {
+        head = &_level0[expires & L0_MASK];
+    } else {
+        // Beyond the wheel's range the timer parks in the farthest level-1
+        // slot and is re-linked every time that slot is cascaded.
+        unsigned long max_delta = static_cast<unsigned long>(L0_SIZE) * L1_SIZE - 1;
+        if (expires - _current > max_delta) expires = _current + max_delta;
+        head = &_level1[(expires >> L0_BITS) & L1_MASK];
+    }
+
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+void TimerWheel::_unlink(Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+void TimerWheel::_cascade() {
+    Timer* head = &_level1[(_current >> L0_BITS) & L1_MASK];
+    Timer* t = head->next;
+    head->prev = head->next = head;
+    while (t != head) {
+        Timer* next = t->next;
+        _link(t);
+        t = next;
+    }
+}
+
+void TimerWheel::advance(unsigned long now_ms, std::vector<int>& expired) {
+    unsigned long target = _tickOf(now_ms);
+    if (_count == 0) {
+        // Nothing armed: jump straight to the present.
+        if (target + 1 > _current) _current = target + 1;
+        return;
+    }
+
+    while (_current <= target) {
+        unsigned long index = _current & L0_MASK;
+        if (index == 0) _cascade();
+        ++_current;
+
+        Timer* head = &_level0[index];
+        while (head->next != head) {
+            Timer* t = head->next;
+            _unlink(t);
+            --_count;
+            expired.push_back(t->fd);
+        }
+        if (_count == 0) {
+            if (target + 1 > _current) _current = target + 1;
+            return;
+        }
+    }
+}
+
+int TimerWheel::timeoutMs(unsigned long now_ms) const {
+    if (_count == 0) return -1;
+
+    // Find the first tick that has work: a non-empty level-0 slot or a
+    // non-empty level-1 slot waiting to be cascaded. The scan is bounded by
+    // one lap of level 0, so it costs the same with 10 or 50k timers.
+    unsigned long tick = _current;
+    for (; tick - _current < static_cast<unsigned long>(L0_SIZE); ++tick) {
+        const Timer* l0 = &_level0[tick & L0_MASK];
+        if (l0->next != l0) break;
+        if ((tick & L0_MASK) == 0) {
+            const Timer* l1 = &_level1[(tick >> L0_BITS) & L1_MASK];
+            if (l1->next != l1) break;
+        }
+    }
+
+    unsigned long due_ms = _base_ms + tick * _tick_ms;
+    if (due_ms <= now_ms) return 0;
+    unsigned long wait = due_ms - now_ms;
+    return wait > 0x7fffffffUL ? 0x7fffffff : static_cast<int>(wait);
+}
+
+size_t TimerWheel::size() const {
+    return _count;
+}
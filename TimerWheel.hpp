@@ -0,0 +1,64 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Two-level hierarchical timing wheel. Timers are intrusive nodes owned by
+// the caller (one per ClientConnection), so schedule() and cancel() are O(1)
+// and never allocate. advance() only visits the slots that are due, and the
+// second level is cascaded into the first once every 256 ticks, which keeps
+// tens of thousands of idle keep-alive timers off the hot path.
+class TimerWheel {
+public:
+    struct Timer {
+        Timer* prev;
+        Timer* next;
+        unsigned long expires; // Absolute tick
+        int fd;
+
+        Timer();
+        bool isActive() const;
+    };
+
+    explicit TimerWheel(unsigned long tick_ms = 100);
+    ~TimerWheel();
+
+    void schedule(Timer* timer, unsigned long delay_ms);
+    void cancel(Timer* timer);
+    // Expires every timer due at now_ms and appends its fd to `expired`.
+    void advance(unsigned long now_ms, std::vector<int>& expired);
+    // Milliseconds until the next timer may fire, or -1 if none is armed.
+    // Suitable as the poller timeout.
+    int timeoutMs(unsigned long now_ms) const;
+    size_t size() const;
+
+    static unsigned long nowMs();
+
+private:
+    enum {
+        L0_BITS = 8,
+        L0_SIZE = 1 << L0_BITS,
+        L0_MASK = L0_SIZE - 1,
+        L1_BITS = 6,
+        L1_SIZE = 1 << L1_BITS,
+        L1_MASK = L1_SIZE - 1
+    };
+
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+
+    void _link(Timer* timer);
+    void _unlink(Timer* timer);
+    void _cascade();
+    unsigned long _tickOf(unsigned long now_ms) const;
+
+    Timer _level0[L0_SIZE]; // List heads (circular, sentinel nodes)
+    Timer _level1[L1_SIZE];
+    unsigned long _current; // Next tick to be processed
+    unsigned long _base_ms;
+    unsigned long _tick_ms;
+    size_t _count;
+};
+
+#endif // TIMER_WHEEL_HPP
@@ -0,0 +1,16 @@
+#ifndef BENCH_CLOCK_HPP
+#define BENCH_CLOCK_HPP
+
+#include <time.h>
+
+// Monotonic seconds, for timing loops in the microbenchmarks.
+static inline double benchNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keeps a computed value alive so the timed loop is not optimised away.
+static volatile unsigned long g_bench_sink;
+
+#endif // BENCH_CLOCK_HPP
@@ -0,0 +1,180 @@
+// Per-event dispatch cost: the fd-indexed handler table the event loop uses
+// against the lookups it replaced (a scan of the listening fds, then up to
+// three std::map probes, repeated by the handler). Both schemes are
+// modelled on the same fd layout, since Server's members are private.
+#include "BenchClock.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+static const int k_listeners = 2;
+static const int k_clients = 1000;
+static const int k_cgi_pipes = 100;
+static const int k_events = 1 << 16;
+static const int k_rounds = 200;
+
+struct Client {
+    unsigned long reads;
+    unsigned long writes;
+};
+
+// Before: listen-fd scan, then CGI and client maps, with the handler
+// looking the client up again.
+class MapDispatcher {
+public:
+    std::vector<int> listen_fds;
+    std::map<int, int> pipe_to_client;
+    std::map<int, int> stdin_to_client;
+    std::map<int, Client*> clients;
+
+    void onRead(int fd) {
+        for (size_t i = 0; i < listen_fds.size(); ++i) {
+            if (fd == listen_fds[i]) {
+                accept(fd);
+                return;
+            }
+        }
+        if (pipe_to_client.count(fd)) {
+            cgiRead(fd);
+        } else if (clients.count(fd)) {
+            clientData(fd);
+        }
+    }
+    void onWrite(int fd) {
+        if (stdin_to_client.count(fd)) {
+            cgiWrite(fd);
+        } else {
+            clientWrite(fd);
+        }
+    }
+
+private:
+    __attribute__((noinline)) void accept(int fd) { g_bench_sink += fd; }
+    __attribute__((noinline)) void cgiRead(int fd) {
+        std::map<int, Client*>::iterator it = clients.find(pipe_to_client[fd]);
+        if (it != clients.end()) ++it->second->reads;
+    }
+    __attribute__((noinline)) void cgiWrite(int fd) {
+        std::map<int, Client*>::iterator it = clients.find(stdin_to_client[fd]);
+        if (it != clients.end()) ++it->second->writes;
+    }
+    __attribute__((noinline)) void clientData(int fd) {
+        std::map<int, Client*>::iterator it = clients.find(fd);
+        if (it != clients.end()) ++it->second->reads;
+    }
+    __attribute__((noinline)) void clientWrite(int fd) {
+        std::map<int, Client*>::iterator it = clients.find(fd);
+        if (it != clients.end()) ++it->second->writes;
+    }
+};
+
+// After: one slot per fd holding a type tag and the owner, and one
+// member-function pointer per type and direction.
+class TableDispatcher {
+public:
+    enum FdType { FD_NONE, FD_LISTEN, FD_CLIENT, FD_CGI_STDOUT, FD_CGI_STDIN, FD_TYPE_COUNT };
+    struct FdSlot {
+        FdType type;
+        Client* owner;
+        FdSlot() : type(FD_NONE), owner(NULL) {}
+    };
+    typedef void (TableDispatcher::*FdHandler)(int fd, Client* owner);
+
+    std::vector<FdSlot> table;
+
+    void set(int fd, FdType type, Client* owner) {
+        if (static_cast<size_t>(fd) >= table.size()) table.resize(fd + 1);
+        table[fd].type = type;
+        table[fd].owner = owner;
+    }
+    void onRead(int fd) {
+        FdSlot slot = table[fd];
+        FdHandler handler = _readHandlers[slot.type];
+        if (handler) (this->*handler)(fd, slot.owner);
+    }
+    void onWrite(int fd) {
+        FdSlot slot = table[fd];
+        FdHandler handler = _writeHandlers[slot.type];
+        if (handler) (this->*handler)(fd, slot.owner);
+    }
+
+private:
+    __attribute__((noinline)) void accept(int fd, Client*) { g_bench_sink += fd; }
+    __attribute__((noinline)) void read(int, Client* owner) { ++owner->reads; }
+    __attribute__((noinline)) void write(int, Client* owner) { ++owner->writes; }
+
+    static const FdHandler _readHandlers[FD_TYPE_COUNT];
+    static const FdHandler _writeHandlers[FD_TYPE_COUNT];
+};
+
+const TableDispatcher::FdHandler TableDispatcher::_readHandlers[TableDispatcher::FD_TYPE_COUNT] = {
+    NULL, &TableDispatcher::accept, &TableDispatcher::read, &TableDispatcher::read, NULL
+};
+const TableDispatcher::FdHandler TableDispatcher::_writeHandlers[TableDispatcher::FD_TYPE_COUNT] = {
+    NULL, NULL, &TableDispatcher::write, NULL, &TableDispatcher::write
+};
+
+template <typename Dispatcher>
+static double run(Dispatcher& dispatcher, const std::vector<int>& reads, const std::vector<int>& writes) {
+    double start = benchNow();
+    for (int round = 0; round < k_rounds; ++round) {
+        for (size_t i = 0; i < reads.size(); ++i) {
+            dispatcher.onRead(reads[i]);
+            dispatcher.onWrite(writes[i]);
+        }
+    }
+    return (benchNow() - start) * 1e9 / (2.0 * k_rounds * reads.size());
+}
+
+int main() {
+    // fds as the loop hands them out: listeners first, then clients with a
+    // CGI stdout/stdin pair for every tenth one.
+    std::vector<Client> clients(k_clients);
+    MapDispatcher old_dispatch;
+    TableDispatcher new_dispatch;
+    std::vector<int> client_fds, cgi_out_fds, cgi_in_fds;
+    int fd = 3;
+    for (int i = 0; i < k_listeners; ++i, ++fd) {
+        old_dispatch.listen_fds.push_back(fd);
+        new_dispatch.set(fd, TableDispatcher::FD_LISTEN, NULL);
+    }
+    for (int i = 0; i < k_clients; ++i) {
+        Client* client = &clients[i];
+        client->reads = client->writes = 0;
+        int client_fd = fd++;
+        client_fds.push_back(client_fd);
+        old_dispatch.clients[client_fd] = client;
+        new_dispatch.set(client_fd, TableDispatcher::FD_CLIENT, client);
+        if (i % (k_clients / k_cgi_pipes) == 0) {
+            int out = fd++, in = fd++;
+            cgi_out_fds.push_back(out);
+            cgi_in_fds.push_back(in);
+            old_dispatch.pipe_to_client[out] = client_fd;
+            old_dispatch.stdin_to_client[in] = client_fd;
+            new_dispatch.set(out, TableDispatcher::FD_CGI_STDOUT, client);
+            new_dispatch.set(in, TableDispatcher::FD_CGI_STDIN, client);
+        }
+    }
+
+    // Mostly client events, some CGI traffic and the odd accept.
+    std::vector<int> reads, writes;
+    std::srand(42);
+    for (int i = 0; i < k_events; ++i) {
+        int pick = std::rand() % 100;
+        if (pick < 2) reads.push_back(3 + pick % k_listeners);
+        else if (pick < 12) reads.push_back(cgi_out_fds[std::rand() % cgi_out_fds.size()]);
+        else reads.push_back(client_fds[std::rand() % client_fds.size()]);
+        pick = std::rand() % 100;
+        if (pick < 5) writes.push_back(cgi_in_fds[std::rand() % cgi_in_fds.size()]);
+        else writes.push_back(client_fds[std::rand() % client_fds.size()]);
+    }
+
+    double before = run(old_dispatch, reads, writes);
+    double after = run(new_dispatch, reads, writes);
+    std::printf("dispatch: %d clients, %d CGI pipe pairs, %d events x %d rounds\n",
+                k_clients, k_cgi_pipes, 2 * k_events, k_rounds);
+    std::printf("  listen scan + std::map lookups  %7.2f ns/event\n", before);
+    std::printf("  fd-indexed handler table        %7.2f ns/event  (%.1fx)\n", after, before / after);
+    return 0;
+}
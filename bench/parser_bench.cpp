@@ -0,0 +1,226 @@
+// Request parser throughput on a pipelined corpus fed in 4 KiB reads, as
+// ClientConnection does: HttpRequestParser (cursor over the input, headers
+// kept as slices of the head) against the parser it replaced, condensed
+// below, which found each CRLF in a std::string and erased the front of it.
+#include "BenchClock.hpp"
+#include "HttpRequestParser.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const size_t k_read_size = 4096;
+static const double k_min_seconds = 0.5;
+
+// The old parse loop: request line, headers, Content-Length and chunked
+// bodies (multipart is left out, the corpus has none).
+class LegacyParser {
+public:
+    enum State { REQUEST_LINE, HEADERS, BODY, CHUNKED_BODY, COMPLETE, ERROR };
+
+    LegacyParser() : _state(REQUEST_LINE), _contentLength(0), _chunkSize(0), _chunkRead(0), _chunk(CHUNK_SIZE) {}
+
+    State parse(std::string& data) {
+        while (_state != COMPLETE && _state != ERROR) {
+            if (_state == REQUEST_LINE || _state == HEADERS) {
+                size_t crlf_pos = data.find("\r\n");
+                if (crlf_pos == std::string::npos) break;
+                std::string line = data.substr(0, crlf_pos);
+                data.erase(0, crlf_pos + 2);
+                if (_state == REQUEST_LINE) {
+                    std::stringstream ss(line);
+                    ss >> _method >> _uri >> _version;
+                    _state = HEADERS;
+                } else if (!line.empty()) {
+                    parseHeader(line);
+                } else if (_headers["Transfer-Encoding"] == "chunked") {
+                    _state = CHUNKED_BODY;
+                } else {
+                    _contentLength = std::strtol(_headers["Content-Length"].c_str(), NULL, 10);
+                    _state = BODY;
+                }
+            } else if (_state == BODY) {
+                size_t to_read = std::min(_contentLength - _body.size(), data.length());
+                _body.append(data.substr(0, to_read));
+                data.erase(0, to_read);
+                if (_body.size() < _contentLength) break;
+                _state = COMPLETE;
+            } else if (_state == CHUNKED_BODY) {
+                if (!parseChunk(data)) break;
+            }
+        }
+        return _state;
+    }
+
+private:
+    enum Chunk { CHUNK_SIZE, CHUNK_DATA, CHUNK_END_CRLF, CHUNK_TRAILER };
+
+    void parseHeader(const std::string& line) {
+        size_t colon_pos = line.find(':');
+        if (colon_pos == std::string::npos) return;
+        std::string key = line.substr(0, colon_pos);
+        std::string value = line.substr(colon_pos + 1);
+        size_t first_char = value.find_first_not_of(" \t");
+        if (first_char != std::string::npos) value = value.substr(first_char);
+        size_t last_char = value.find_last_not_of(" \t\r\n");
+        if (last_char != std::string::npos) value = value.substr(0, last_char + 1);
+        _headers[key] = value;
+    }
+
+    // One step of the chunked body; false when more data is needed.
+    bool parseChunk(std::string& data) {
+        if (_chunk == CHUNK_SIZE || _chunk == CHUNK_TRAILER) {
+            size_t crlf_pos = data.find("\r\n");
+            if (crlf_pos == std::string::npos) return false;
+            std::string line = data.substr(0, crlf_pos);
+            data.erase(0, crlf_pos + 2);
+            if (_chunk == CHUNK_TRAILER) {
+                if (line.empty()) _state = COMPLETE;
+                return true;
+            }
+            _chunkSize = std::strtol(line.c_str(), NULL, 16);
+            _chunkRead = 0;
+            _chunk = _chunkSize == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+        } else if (_chunk == CHUNK_DATA) {
+            size_t to_read = std::min(_chunkSize - _chunkRead, data.length());
+            _body.append(data.substr(0, to_read));
+            data.erase(0, to_read);
+            _chunkRead += to_read;
+            if (_chunkRead < _chunkSize) return false;
+            _chunk = CHUNK_END_CRLF;
+        } else {
+            if (data.length() < 2) return false;
+            data.erase(0, 2);
+            _chunk = CHUNK_SIZE;
+        }
+        return true;
+    }
+
+    State _state;
+    std::string _method, _uri, _version, _body;
+    std::map<std::string, std::string> _headers;
+    size_t _contentLength;
+    size_t _chunkSize;
+    size_t _chunkRead;
+    Chunk _chunk;
+};
+
+static std::string number(size_t n) {
+    std::ostringstream out;
+    out << n;
+    return out.str();
+}
+
+// Browser-like GETs with a long header block, form POSTs and chunked
+// uploads, pipelined back to back.
+static std::string buildCorpus(size_t& requests) {
+    std::string corpus;
+    std::string form(1024, 'f');
+    std::string chunk(3000, 'c');
+    requests = 0;
+    for (int i = 0; i < 2000; ++i, ++requests) {
+        if (i % 10 == 8) {
+            corpus += "POST /api/v1/items?id=" + number(i) + " HTTP/1.1\r\nHost: example.com\r\n"
+                      "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: "
+                      + number(form.size()) + "\r\n\r\n" + form;
+        } else if (i % 10 == 9) {
+            corpus += "PUT /upload/file" + number(i) + " HTTP/1.1\r\nHost: example.com\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n";
+            for (int c = 0; c < 4; ++c) corpus += "bb8\r\n" + chunk + "\r\n";
+            corpus += "0\r\n\r\n";
+        } else {
+            corpus += "GET /static/img/photo" + number(i) + ".jpg?v=3 HTTP/1.1\r\n"
+                      "Host: example.com\r\n"
+                      "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 Safari/537.36\r\n"
+                      "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+                      "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+                      "Accept-Language: pt-BR,pt;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+                      "Cache-Control: no-cache\r\nConnection: keep-alive\r\nPragma: no-cache\r\n"
+                      "Referer: https://example.com/gallery/index.html\r\n"
+                      "Sec-Fetch-Dest: image\r\nSec-Fetch-Mode: no-cors\r\nSec-Fetch-Site: same-origin\r\n"
+                      "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; lang=pt-BR\r\n"
+                      "If-None-Match: \"1a2b3c-4d5e-6f70\"\r\n\r\n";
+        }
+    }
+    return corpus;
+}
+
+// Appends reads to a buffer that the parser erases from, as the server did.
+static size_t runLegacy(const std::string& corpus) {
+    std::string pending;
+    LegacyParser* parser = new LegacyParser();
+    size_t done = 0;
+    for (size_t pos = 0; pos < corpus.size(); pos += k_read_size) {
+        pending.append(corpus, pos, k_read_size);
+        while (parser->parse(pending) == LegacyParser::COMPLETE) {
+            ++done;
+            delete parser;
+            parser = new LegacyParser();
+        }
+    }
+    delete parser;
+    return done;
+}
+
+// Appends reads to an input buffer and parses from a cursor, as
+// ClientConnection::parseInput() does.
+static size_t runCursor(const std::string& corpus) {
+    std::string input;
+    size_t input_pos = 0;
+    HttpRequestParser* parser = new HttpRequestParser();
+    size_t done = 0;
+    for (size_t pos = 0; pos < corpus.size(); pos += k_read_size) {
+        input.append(corpus, pos, k_read_size);
+        while (input_pos < input.size()) {
+            size_t consumed = parser->parse(input.data() + input_pos, input.size() - input_pos);
+            input_pos += consumed;
+            if (parser->getState() == HttpRequestParser::PARSING_COMPLETE) {
+                ++done;
+                delete parser;
+                parser = new HttpRequestParser();
+            } else if (consumed == 0) {
+                break;
+            }
+        }
+        if (input_pos == input.size()) {
+            input.clear();
+            input_pos = 0;
+        } else if (input_pos >= k_read_size && input_pos * 2 >= input.size()) {
+            input.erase(0, input_pos);
+            input_pos = 0;
+        }
+    }
+    delete parser;
+    return done;
+}
+
+template <typename Run>
+static void report(const char* name, Run run, const std::string& corpus, size_t requests) {
+    long passes = 0;
+    double start = benchNow(), elapsed;
+    do {
+        if (run(corpus) != requests) {
+            std::printf("  %s: parsed the wrong number of requests\n", name);
+            std::exit(1);
+        }
+        ++passes;
+        elapsed = benchNow() - start;
+    } while (elapsed < k_min_seconds);
+    double seconds = elapsed / passes;
+    std::printf("  %-34s %8.1f MB/s %10.0f req/s\n", name,
+                corpus.size() / seconds / 1e6, requests / seconds);
+}
+
+int main() {
+    size_t requests;
+    std::string corpus = buildCorpus(requests);
+    std::printf("parser: %lu pipelined requests, %.1f MB, %lu-byte reads\n",
+                static_cast<unsigned long>(requests), corpus.size() / 1e6,
+                static_cast<unsigned long>(k_read_size));
+    report("find/substr/erase (before)", runLegacy, corpus, requests);
+    report("cursor + header slices (after)", runCursor, corpus, requests);
+    return 0;
+}
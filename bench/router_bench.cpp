@@ -0,0 +1,86 @@
+// Location lookup with 1k prefix locations: the compiled radix tree in
+// LocationRouter against the linear longest-prefix scan it replaced (an
+// rfind and a string copy per candidate). Both must agree on every URI.
+#include "BenchClock.hpp"
+#include "LocationRouter.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int k_locations = 1000;
+static const int k_uris = 4096;
+static const int k_rounds = 50;
+
+// The lookup from before the router, as it was in _handleClientData.
+static const LocationConfig* linearFind(const std::vector<LocationConfig*>& locations, const std::string& uri) {
+    const LocationConfig* matched_location = NULL;
+    std::string longest_match = "";
+    for (size_t i = 0; i < locations.size(); ++i) {
+        if (uri.rfind(locations[i]->path, 0) == 0) {
+            if (locations[i]->path.length() > longest_match.length()) {
+                longest_match = locations[i]->path;
+                matched_location = locations[i];
+            }
+        }
+    }
+    return matched_location;
+}
+
+static std::string number(int n) {
+    std::ostringstream out;
+    out << n;
+    return out.str();
+}
+
+int main() {
+    // Nested API and per-team static trees, as in a large gateway config.
+    std::vector<LocationConfig*> locations;
+    LocationConfig* root = new LocationConfig();
+    root->path = "/";
+    locations.push_back(root);
+    for (int i = 0; locations.size() < static_cast<size_t>(k_locations); ++i) {
+        const char* shapes[] = { "/api/v1/service", "/api/v2/service", "/static/team", "/svc-" };
+        LocationConfig* loc = new LocationConfig();
+        loc->path = std::string(shapes[i % 4]) + number(i / 4);
+        if (i % 3 == 0) loc->path += "/admin";
+        loc->id = locations.size();
+        locations.push_back(loc);
+    }
+    LocationRouter router;
+    router.build(locations);
+
+    std::vector<std::string> uris;
+    std::srand(7);
+    for (int i = 0; i < k_uris; ++i) {
+        const LocationConfig* target = locations[1 + std::rand() % (locations.size() - 1)];
+        if (i % 10 == 0) uris.push_back("/unknown/path/" + number(i)); // Falls back to "/"
+        else uris.push_back(target->path + "/items/" + number(std::rand() % 1000) + "?page=2");
+    }
+    for (size_t i = 0; i < uris.size(); ++i) {
+        if (router.find(uris[i]) != linearFind(locations, uris[i])) {
+            std::printf("router: mismatch on %s\n", uris[i].c_str());
+            return 1;
+        }
+    }
+
+    double start = benchNow();
+    for (int round = 0; round < k_rounds; ++round) {
+        for (size_t i = 0; i < uris.size(); ++i) g_bench_sink += linearFind(locations, uris[i])->id;
+    }
+    double linear = (benchNow() - start) * 1e9 / (k_rounds * uris.size());
+    start = benchNow();
+    for (int round = 0; round < k_rounds; ++round) {
+        for (size_t i = 0; i < uris.size(); ++i) g_bench_sink += router.find(uris[i])->id;
+    }
+    double tree = (benchNow() - start) * 1e9 / (k_rounds * uris.size());
+
+    std::printf("router: %lu locations, %d URIs x %d rounds\n",
+                static_cast<unsigned long>(locations.size()), k_uris, k_rounds);
+    std::printf("  linear longest-prefix scan  %9.1f ns/lookup\n", linear);
+    std::printf("  radix tree                  %9.1f ns/lookup  (%.0fx)\n", tree, linear / tree);
+
+    for (size_t i = 0; i < locations.size(); ++i) delete locations[i];
+    return 0;
+}
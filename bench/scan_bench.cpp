@@ -0,0 +1,148 @@
+// ByteScan throughput per kernel (scalar, SSE2, AVX2, forced with
+// ByteScan::select()): find, findEither and findString over a long span
+// and over header-sized lines, then the whole parser on a header-heavy
+// corpus and on a large multipart body.
+#include "BenchClock.hpp"
+#include "ByteScan.hpp"
+#include "HttpRequestParser.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+static const size_t k_span = 1024 * 1024;
+static const size_t k_line = 64; // Typical header line
+static const double k_min_seconds = 0.3;
+static const char* k_kernels[] = { "scalar", "sse2", "avx2" };
+
+// Calls `scan` over the buffer in pieces of `stride` bytes until the time
+// is up; returns GB/s.
+template <typename Scan>
+static double throughput(const std::string& buffer, size_t stride, Scan scan) {
+    const char* begin = buffer.data();
+    const char* end = begin + buffer.size();
+    size_t bytes = 0;
+    double start = benchNow(), elapsed;
+    do {
+        for (const char* p = begin; p < end; p += stride) {
+            const char* hit = scan(p, p + stride);
+            g_bench_sink += hit ? hit - p : 0;
+        }
+        bytes += buffer.size();
+        elapsed = benchNow() - start;
+    } while (elapsed < k_min_seconds);
+    return bytes / elapsed / 1e9;
+}
+
+static const char* scanFind(const char* p, const char* end) {
+    return ByteScan::find(p, end, '\n');
+}
+
+static const char* scanEither(const char* p, const char* end) {
+    return ByteScan::findEither(p, end, '\r', '\n');
+}
+
+static std::string g_needle = "\r\n------WebKitFormBoundary7MA4YWxkTrZu0gW";
+
+static const char* scanString(const char* p, const char* end) {
+    return ByteScan::findString(p, end, g_needle);
+}
+
+// Text without the delimiters, each `line` bytes ending in the delimiter
+// (or none when `line` is 0).
+static std::string text(size_t size, size_t line) {
+    std::string out(size, 'x');
+    std::srand(5);
+    for (size_t i = 0; i < size; ++i) out[i] = 'a' + std::rand() % 26;
+    if (line > 0) {
+        for (size_t i = line - 1; i < size; i += line) out[i] = '\n';
+    }
+    return out;
+}
+
+static std::string headerCorpus(size_t& requests) {
+    std::string corpus;
+    requests = 0;
+    while (corpus.size() < 4 * 1024 * 1024) {
+        corpus += "GET /static/img/photo.jpg?v=3 HTTP/1.1\r\nHost: example.com\r\n"
+                  "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/126.0 Safari/537.36\r\n"
+                  "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+                  "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+                  "Accept-Language: pt-BR,pt;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+                  "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark; lang=pt-BR\r\n"
+                  "Referer: https://example.com/gallery/index.html\r\n\r\n";
+        ++requests;
+    }
+    return corpus;
+}
+
+static std::string multipartRequest() {
+    std::string body = "------WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+                       "Content-Disposition: form-data; name=\"file\"; filename=\"big.bin\"\r\n"
+                       "Content-Type: application/octet-stream\r\n\r\n"
+                       + text(8 * 1024 * 1024, 0)
+                       + "\r\n------WebKitFormBoundary7MA4YWxkTrZu0gW--\r\n";
+    std::ostringstream head;
+    head << "POST /upload HTTP/1.1\r\nHost: example.com\r\n"
+         << "Content-Type: multipart/form-data; boundary=----WebKitFormBoundary7MA4YWxkTrZu0gW\r\n"
+         << "Content-Length: " << body.size() << "\r\n\r\n";
+    return head.str() + body;
+}
+
+// Parses `input` as pipelined requests from one buffer; returns GB/s.
+static double parserThroughput(const std::string& input, size_t requests) {
+    size_t bytes = 0;
+    double start = benchNow(), elapsed;
+    do {
+        size_t pos = 0, done = 0;
+        while (pos < input.size()) {
+            HttpRequestParser parser;
+            while (parser.getState() != HttpRequestParser::PARSING_COMPLETE) {
+                size_t consumed = parser.parse(input.data() + pos, input.size() - pos);
+                if (consumed == 0 && parser.getState() != HttpRequestParser::PARSING_COMPLETE) {
+                    std::printf("  parser stalled\n");
+                    std::exit(1);
+                }
+                pos += consumed;
+            }
+            ++done;
+        }
+        if (done != requests) {
+            std::printf("  parsed %lu requests, expected %lu\n",
+                        static_cast<unsigned long>(done), static_cast<unsigned long>(requests));
+            std::exit(1);
+        }
+        bytes += input.size();
+        elapsed = benchNow() - start;
+    } while (elapsed < k_min_seconds);
+    return bytes / elapsed / 1e9;
+}
+
+int main() {
+    std::string span = text(k_span, 0);
+    std::string lines = text(k_span, k_line);
+    size_t header_requests;
+    std::string headers = headerCorpus(header_requests);
+    std::string multipart = multipartRequest();
+
+    std::printf("scan: GB/s per kernel (best on this CPU: %s)\n", ByteScan::name(ByteScan::best()));
+    std::printf("  %-8s %9s %9s %9s %9s %9s %11s %11s\n", "kernel", "find", "find", "either",
+                "either", "string", "parser", "parser");
+    std::printf("  %-8s %9s %9s %9s %9s %9s %11s %11s\n", "", "1 MiB", "64 B", "1 MiB",
+                "64 B", "1 MiB", "headers", "multipart");
+    for (int k = 0; k < 3; ++k) {
+        if (!ByteScan::select(k_kernels[k])) {
+            std::printf("  %-8s not supported by this CPU\n", k_kernels[k]);
+            continue;
+        }
+        std::printf("  %-8s %9.2f %9.2f %9.2f %9.2f %9.2f %11.2f %11.2f\n", k_kernels[k],
+                    throughput(span, span.size(), scanFind),
+                    throughput(lines, k_line, scanFind),
+                    throughput(span, span.size(), scanEither),
+                    throughput(lines, k_line, scanEither),
+                    throughput(span, span.size(), scanString),
+                    parserThroughput(headers, header_requests),
+                    parserThroughput(multipart, 1));
+    }
+    return 0;
+}